@@ -0,0 +1,382 @@
+#include "Patterns.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// corpora are generated from a fixed seed so every run searches the same bytes
+constexpr std::uint64_t CORPUS_SEED = 0x6772657063707000;
+constexpr std::size_t DEFAULT_MAX_CORPUS_SIZE = 1 << 24;
+
+enum class LineLengths
+{
+  Fixed,       // every line is the mean length
+  Uniform,     // anywhere from 1 to twice the mean
+  Exponential  // mostly short with a long tail of very long lines
+};
+
+static const char* lineLengthsName(LineLengths lengths)
+{
+  switch (lengths)
+  {
+    case LineLengths::Fixed: return "fixed";
+    case LineLengths::Uniform: return "uniform";
+    case LineLengths::Exponential: return "exponential";
+  }
+
+  return "";
+}
+
+/**********************************************************************
+ * generateCorpus
+ *
+ * Description: Builds a log like corpus of words, numbers and the odd
+ *      repeated word so every kind of pattern has something to find
+ *
+ * Parameters:
+ *   size: the number of bytes to generate
+ *   lengths: how the line lengths are distributed
+ *   meanLength: the average line length
+ *
+ * Returns: the corpus, every line ends in a newline
+ *********************************************************************/
+static std::string generateCorpus(std::size_t size, LineLengths lengths, std::size_t meanLength)
+{
+  static const std::vector<std::string> words = {
+    "ERROR", "WARN", "INFO", "DEBUG", "request", "user", "timeout", "connection", "reset", "id",
+    "host", "db01.example.com", "latency", "ms", "retry", "cache", "miss", "hit", "the", "a_b"
+  };
+
+  std::mt19937_64 random(CORPUS_SEED + size + static_cast<int>(lengths));
+  std::uniform_int_distribution<std::size_t> uniform(1, meanLength * 2);
+  std::exponential_distribution<double> exponential(1.0 / meanLength);
+  std::uniform_int_distribution<std::size_t> pick(0, words.size() + 3);
+
+  std::string corpus;
+  corpus.reserve(size + meanLength * 2);
+
+  while (corpus.size() < size)
+  {
+    std::size_t length = meanLength;
+    if (lengths == LineLengths::Uniform)
+      length = uniform(random);
+    else if (lengths == LineLengths::Exponential)
+      length = std::min<std::size_t>(1 + exponential(random), 1 << 16);
+
+    std::size_t lineStart = corpus.size();
+    std::string previous;
+
+    while (corpus.size() - lineStart < length)
+    {
+      std::size_t choice = pick(random);
+      std::string word;
+
+      if (choice < words.size())
+        word = words[choice];
+      else if (choice == words.size())
+        word = std::to_string(random() % 100000);
+      else if (choice == words.size() + 1)
+        word = previous; // repeated words give backreferences something to match
+      else
+        word = std::string(1 + random() % 8, 'a');
+
+      corpus += word;
+      corpus += ' ';
+      previous = word;
+    }
+
+    corpus.back() = '\n';
+  }
+
+  return corpus;
+}
+
+/**********************************************************************
+ * corpus
+ *
+ * Description: Generates each corpus only once per process, the large
+ *      ones take longer to build than to search. Threaded benchmarks
+ *      ask for it from every thread at once
+ *
+ * Returns: the corpus split into lines without their newlines
+ *********************************************************************/
+static const std::pair<std::string, std::vector<std::string_view>>& corpus(std::size_t size, LineLengths lengths, std::size_t meanLength)
+{
+  static std::map<std::tuple<std::size_t, LineLengths, std::size_t>, std::pair<std::string, std::vector<std::string_view>>> corpora;
+  static std::mutex corporaLock;
+
+  std::lock_guard<std::mutex> lock(corporaLock);
+
+  auto key = std::make_tuple(size, lengths, meanLength);
+  if (auto it = corpora.find(key); it != corpora.end())
+    return it->second;
+
+  auto& entry = corpora[key];
+  entry.first = generateCorpus(size, lengths, meanLength);
+
+  std::string_view data = entry.first;
+  for (std::size_t start = 0, end; start < data.size(); start = end + 1)
+  {
+    end = data.find('\n', start);
+    entry.second.push_back(data.substr(start, end - start));
+  }
+
+  return entry;
+}
+
+/**********************************************************************
+ * matchLines
+ *
+ * Description: Matches every line of a corpus against a pattern that
+ *      was compiled once, reporting bytes and lines per second
+ *********************************************************************/
+static void matchLines(benchmark::State& state, const std::string& patterns, LineLengths lengths, std::size_t meanLength)
+{
+  const auto& [data, lines] = corpus(state.range(0), lengths, meanLength);
+  CompiledPattern pattern(patterns);
+  std::size_t matched = 0;
+
+  for (auto _ : state)
+  {
+    for (std::string_view line : lines)
+      matched += pattern.matches(line);
+
+    benchmark::DoNotOptimize(matched);
+  }
+
+  state.SetBytesProcessed(state.iterations() * data.size());
+  state.counters["lines/s"] = benchmark::Counter(state.iterations() * lines.size(), benchmark::Counter::kIsRate);
+  state.counters["matched"] = matched / std::max<std::size_t>(state.iterations(), 1);
+}
+
+/**********************************************************************
+ * findLines
+ *
+ * Description: Same as matchLines but asks for the end of the match so
+ *      the position tracking engines are measured
+ *********************************************************************/
+static void findLines(benchmark::State& state, const std::string& patterns, LineLengths lengths, std::size_t meanLength)
+{
+  const auto& [data, lines] = corpus(state.range(0), lengths, meanLength);
+  CompiledPattern pattern(patterns);
+  std::size_t matched = 0;
+
+  for (auto _ : state)
+  {
+    for (std::string_view line : lines)
+      matched += pattern.match(line) != std::string::npos;
+
+    benchmark::DoNotOptimize(matched);
+  }
+
+  state.SetBytesProcessed(state.iterations() * data.size());
+  state.counters["lines/s"] = benchmark::Counter(state.iterations() * lines.size(), benchmark::Counter::kIsRate);
+}
+
+/**********************************************************************
+ * pathological
+ *
+ * Description: Patterns that blow up a backtracking matcher, run on a
+ *      single line of 'a's that almost matches
+ *********************************************************************/
+static void pathological(benchmark::State& state, const std::string& patterns)
+{
+  std::string line(state.range(0), 'a');
+  CompiledPattern pattern(patterns);
+
+  for (auto _ : state)
+    benchmark::DoNotOptimize(pattern.match(line));
+
+  state.SetBytesProcessed(state.iterations() * line.size());
+}
+
+/**********************************************************************
+ * compileAndMatch
+ *
+ * Description: The one shot PatternHandler, compiling for every line
+ *********************************************************************/
+static void compileAndMatch(benchmark::State& state, const std::string& patterns)
+{
+  const auto& [data, lines] = corpus(state.range(0), LineLengths::Fixed, 80);
+
+  for (auto _ : state)
+  {
+    for (std::string_view line : lines)
+      benchmark::DoNotOptimize(static_cast<std::size_t>(PatternHandler(std::string(line), patterns)));
+  }
+
+  state.SetBytesProcessed(state.iterations() * data.size());
+  state.counters["lines/s"] = benchmark::Counter(state.iterations() * lines.size(), benchmark::Counter::kIsRate);
+}
+
+/**********************************************************************
+ * ruleSet
+ *
+ * Description: Matches every line against a large pattern set like a
+ *      file of alert rules, where only a few lines match any rule
+ *********************************************************************/
+static void ruleSet(benchmark::State& state, std::shared_ptr<const CompiledPattern> rules)
+{
+  const auto& [data, lines] = corpus(state.range(0), LineLengths::Uniform, 80);
+  std::vector<std::size_t> matched;
+
+  for (auto _ : state)
+  {
+    for (std::string_view line : lines)
+    {
+      rules->matchingPatterns(line, matched);
+      benchmark::DoNotOptimize(matched.data());
+    }
+  }
+
+  state.SetBytesProcessed(state.iterations() * data.size());
+  state.counters["lines/s"] = benchmark::Counter(state.iterations() * lines.size(), benchmark::Counter::kIsRate);
+}
+
+// patterns compiled once and shared by every thread, with the single threaded results
+struct ConcurrentPatterns
+{
+  std::vector<std::string> patterns;
+  std::vector<std::unique_ptr<CompiledPattern>> shared;
+  std::vector<std::vector<std::size_t>> expected; // match() of every line for each pattern
+};
+
+/**********************************************************************
+ * concurrentMatch
+ *
+ * Description: Stress test for compiling and matching on many threads
+ *      at once. Every thread compiles its own copy of each pattern
+ *      while matching with the shared copies, any result that differs
+ *      from the single threaded answer fails the benchmark
+ *********************************************************************/
+static void concurrentMatch(benchmark::State& state, std::shared_ptr<const ConcurrentPatterns> concurrent)
+{
+  const auto& [data, lines] = corpus(state.range(0), LineLengths::Uniform, 80);
+  bool failed = false;
+
+  for (auto _ : state)
+  {
+    for (std::size_t k = 0; k < concurrent->patterns.size() && !failed; ++k)
+    {
+      CompiledPattern own(concurrent->patterns[k]);
+      const CompiledPattern& shared = *concurrent->shared[k];
+
+      for (std::size_t i = 0; i < lines.size() && !failed; ++i)
+      {
+        std::size_t expected = concurrent->expected[k][i];
+        bool expectedMatch = expected != std::string::npos;
+
+        failed = shared.match(lines[i]) != expected || shared.matches(lines[i]) != expectedMatch ||
+                 own.matches(lines[i]) != expectedMatch;
+      }
+    }
+
+    if (failed)
+    {
+      state.SkipWithError("A concurrent match gave a different result from the single threaded one");
+      break;
+    }
+  }
+
+  state.SetBytesProcessed(state.iterations() * data.size() * concurrent->patterns.size());
+  state.counters["lines/s"] = benchmark::Counter(state.iterations() * lines.size() * concurrent->patterns.size(), benchmark::Counter::kIsRate);
+}
+
+int main(int argc, char** argv)
+{
+  // one pattern for every kind of Pattern and quantifier
+  const std::vector<std::pair<std::string, std::string>> patterns = {
+    {"literal", "timeout"},
+    {"literal_rare", "db01.example.com"},
+    {"digits", "\\d\\d\\d\\d"},
+    {"alphanum", "\\w+ \\d+ ms"},
+    {"positive_group", "[xyz]"},
+    {"negative_group", "[^a-z0-9 ._]"},
+    {"range_group", "[A-Z][A-Z]+ [a-z]+"},
+    {"start_anchor", "^ERROR"},
+    {"end_anchor", "hit$"},
+    {"literal_suffix", ".*\\d+ timeout"},
+    {"wildcard", "E.R.R"},
+    {"alternation", "(ERROR|WARN) user"},
+    {"keywords", "ERROR|WARN|timeout|db01.example.com|cache miss"},
+    {"reference", "(retry)+ cache"},
+    {"backreference", "(\\w+) \\1"},
+    {"one_or_more", "a+ a+ a+ timeout"},
+    {"optional_stack", "x?x?x?x?x?x?x?x?aaaaaaaa"},
+  };
+
+  // corpora above 16 MiB (up to 1 GiB) only run when asked for
+  std::size_t maxSize = DEFAULT_MAX_CORPUS_SIZE;
+  if (const char* size = std::getenv("GREP_BENCH_MAX_SIZE"))
+    maxSize = std::strtoull(size, nullptr, 10);
+
+  std::vector<std::int64_t> sizes;
+  for (std::size_t size = 1 << 10; size <= maxSize && size <= (std::size_t(1) << 30); size *= 16)
+    sizes.push_back(size);
+
+  for (const auto& [name, pattern] : patterns)
+  {
+    for (LineLengths lengths : {LineLengths::Fixed, LineLengths::Uniform, LineLengths::Exponential})
+    {
+      auto* matchBenchmark = benchmark::RegisterBenchmark(("match/" + name + "/" + lineLengthsName(lengths)).c_str(), matchLines, pattern, lengths, 80);
+      auto* findBenchmark = benchmark::RegisterBenchmark(("find/" + name + "/" + lineLengthsName(lengths)).c_str(), findLines, pattern, lengths, 80);
+
+      for (std::int64_t size : sizes)
+      {
+        matchBenchmark->Arg(size);
+        findBenchmark->Arg(size);
+      }
+    }
+  }
+
+  for (const char* pattern : {"(a+)+b", "(a|aa)+b", "a?a?a?a?a?a?a?a?a?a?a?a?a?a?a?a?aaaaaaaaaaaaaaaab"})
+    benchmark::RegisterBenchmark((std::string("pathological/") + pattern).c_str(), pathological, std::string(pattern))->Arg(16)->Arg(1 << 10)->Arg(1 << 16);
+
+  benchmark::RegisterBenchmark("compile_and_match/alternation", compileAndMatch, "(ERROR|WARN) user")->Arg(1 << 16);
+
+  // one rule per host, only the corpus's own host is ever found
+  std::vector<std::string> rules;
+  for (int host = 0; host < 5000; ++host)
+  {
+    std::string name = (host < 10 ? "db0" : "db") + std::to_string(host) + ".example.com";
+    rules.push_back(host % 2 ? "(ERROR|WARN) \\w+ " + name : name + " latency \\d+");
+  }
+
+  auto* ruleSetBenchmark = benchmark::RegisterBenchmark("rule_set/5000", ruleSet, std::make_shared<const CompiledPattern>(rules));
+  for (std::int64_t size : sizes)
+    ruleSetBenchmark->Arg(size);
+
+  // one pattern per engine: NFA and lazy DFA, keywords, prefilter and backtracker
+  auto concurrent = std::make_shared<ConcurrentPatterns>();
+  concurrent->patterns = {"(ERROR|WARN) user", "ERROR|WARN|timeout", "\\w+ \\d+ ms$", "(\\w+) \\1", "[A-Z]+ [a-z]+ (\\d+)"};
+
+  const std::int64_t concurrentSize = 1 << 20;
+  const auto& [concurrentData, concurrentLines] = corpus(concurrentSize, LineLengths::Uniform, 80);
+
+  for (const std::string& pattern : concurrent->patterns)
+  {
+    concurrent->shared.push_back(std::make_unique<CompiledPattern>(pattern));
+    concurrent->expected.emplace_back();
+
+    for (std::string_view line : concurrentLines)
+      concurrent->expected.back().push_back(concurrent->shared.back()->match(line));
+  }
+
+  benchmark::RegisterBenchmark("concurrent/compile_and_match", concurrentMatch, std::shared_ptr<const ConcurrentPatterns>(concurrent))
+    ->Arg(concurrentSize)->ThreadRange(1, 8)->UseRealTime();
+
+  benchmark::Initialize(&argc, argv);
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+
+  return 0;
+}
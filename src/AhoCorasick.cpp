@@ -0,0 +1,371 @@
+#include "AhoCorasick.hpp"
+#include "PatternCache.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+// set on a transition to a state where a keyword ends
+constexpr std::uint32_t MATCH_FLAG = 1u << 31;
+constexpr std::uint32_t NO_STATE = ~std::uint32_t(0);
+
+// skipping from the start state only pays off when few bytes can start a keyword
+constexpr std::size_t MAX_SKIP_CHARACTERS = 32;
+
+// the keywords findAll already has, only the bits it set are cleared again
+static thread_local std::vector<bool> t_seen;
+
+/**********************************************************************
+ * AhoCorasick
+ *
+ * Description: Builds the keyword trie then fills in every missing
+ *      transition from the failure links so matching is a single table
+ *      lookup per byte. States are numbered breadth first so the ones
+ *      near the start, which are used the most, share cache lines
+ *
+ * Parameters:
+ *   keywords: the literals to search for, none may be empty
+ *********************************************************************/
+AhoCorasick::AhoCorasick(const std::vector<std::string>& keywords)
+: m_keywords(keywords)
+{
+  CharacterSet startCharacters;
+
+  for (const std::string& keyword : m_keywords)
+  {
+    if (keyword.empty())
+      throw std::runtime_error("Keywords can't be empty");
+
+    startCharacters.set(static_cast<unsigned char>(keyword[0]));
+
+    for (unsigned char c : keyword)
+    {
+      if (m_byteClasses[c] == 0)
+        m_byteClasses[c] = m_classCount++;
+    }
+  }
+
+  // build the trie with a state per row, children are filled in as found
+  std::vector<std::uint32_t> trie(m_classCount, NO_STATE);
+  std::vector<std::uint32_t> outputs(1, NO_STATE);
+  m_repeats.assign(m_keywords.size(), NO_STATE);
+
+  for (std::size_t k = 0; k < m_keywords.size(); ++k)
+  {
+    std::uint32_t state = 0;
+
+    for (unsigned char c : m_keywords[k])
+    {
+      std::size_t transition = state * m_classCount + m_byteClasses[c];
+
+      if (trie[transition] == NO_STATE)
+      {
+        trie[transition] = outputs.size();
+        outputs.push_back(NO_STATE);
+        trie.resize(trie.size() + m_classCount, NO_STATE);
+      }
+
+      state = trie[transition];
+    }
+
+    // a repeated keyword keeps the first index and is chained to the rest
+    if (outputs[state] == NO_STATE)
+    {
+      outputs[state] = k;
+    }
+    else
+    {
+      std::uint32_t last = outputs[state];
+      while (m_repeats[last] != NO_STATE)
+        last = m_repeats[last];
+      m_repeats[last] = k;
+    }
+  }
+
+  // number the states breadth first and link each one to its longest proper suffix
+  std::size_t stateCount = outputs.size();
+  std::vector<std::uint32_t> order(1, 0), number(stateCount, NO_STATE), failure(stateCount, 0);
+  std::vector<std::uint32_t> ownOutputs(outputs), outputLinks(stateCount, NO_STATE);
+  number[0] = 0;
+
+  for (std::size_t i = 0; i < order.size(); ++i)
+  {
+    std::uint32_t state = order[i];
+
+    for (std::uint32_t byteClass = 0; byteClass < m_classCount; ++byteClass)
+    {
+      std::uint32_t child = trie[state * m_classCount + byteClass];
+      if (child == NO_STATE)
+        continue;
+
+      number[child] = order.size();
+      order.push_back(child);
+
+      if (state != 0)
+      {
+        // the parent's failure state already has all of its transitions filled in
+        std::uint32_t suffix = trie[failure[state] * m_classCount + byteClass];
+        failure[child] = suffix;
+        outputLinks[child] = ownOutputs[suffix] != NO_STATE ? suffix : outputLinks[suffix];
+
+        // a keyword ending at the suffix also ends here, but any keyword of the child's own is longer
+        if (outputs[child] == NO_STATE)
+          outputs[child] = outputs[suffix];
+      }
+    }
+
+    // missing transitions go where the failure state would go
+    for (std::uint32_t byteClass = 0; byteClass < m_classCount; ++byteClass)
+    {
+      std::uint32_t& next = trie[state * m_classCount + byteClass];
+
+      if (next == NO_STATE)
+        next = state == 0 ? 0 : trie[failure[state] * m_classCount + byteClass];
+    }
+  }
+
+  // lay the table out in breadth first order with flagged row offsets
+  m_transitions.resize(stateCount * m_classCount);
+  m_outputs.resize(stateCount);
+  m_ownOutputs.resize(stateCount);
+  m_outputLinks.resize(stateCount);
+
+  for (std::size_t state = 0; state < stateCount; ++state)
+  {
+    std::size_t row = number[state] * m_classCount;
+    m_outputs[number[state]] = outputs[state];
+    m_ownOutputs[number[state]] = ownOutputs[state];
+    m_outputLinks[number[state]] = outputLinks[state] == NO_STATE ? NO_STATE : number[outputLinks[state]];
+
+    for (std::uint32_t byteClass = 0; byteClass < m_classCount; ++byteClass)
+    {
+      std::uint32_t next = trie[state * m_classCount + byteClass];
+      std::uint32_t target = number[next] * m_classCount;
+
+      if (outputs[next] != NO_STATE)
+        target |= MATCH_FLAG;
+
+      m_transitions[row + byteClass] = target;
+    }
+  }
+
+  if (m_transitions.size() >= MATCH_FLAG)
+    throw std::runtime_error("Too many keywords to search for at once");
+
+  m_startClass = CharacterClass(startCharacters);
+  m_skipStart = startCharacters.count() <= MAX_SKIP_CHARACTERS;
+}
+
+/**********************************************************************
+ * AhoCorasick
+ *
+ * Description: Loads the tables written by save() instead of building
+ *      them again
+ *
+ * Parameters:
+ *   reader: the cache positioned at the automaton
+ *********************************************************************/
+AhoCorasick::AhoCorasick(CacheReader& reader)
+{
+  // even an empty keyword has its length
+  m_keywords.resize(reader.readCount(sizeof(std::uint64_t)));
+  for (std::string& keyword : m_keywords)
+    keyword = reader.readString();
+
+  m_byteClasses = reader.read<std::array<std::uint8_t, 256>>();
+  m_classCount = reader.read<std::uint32_t>();
+  m_transitions = reader.readVector<std::uint32_t>();
+  m_outputs = reader.readVector<std::uint32_t>();
+  m_ownOutputs = reader.readVector<std::uint32_t>();
+  m_outputLinks = reader.readVector<std::uint32_t>();
+  m_repeats = reader.readVector<std::uint32_t>();
+  m_startClass = CharacterClass(reader.readCharacterSet());
+  m_skipStart = reader.read<std::uint8_t>();
+
+  // the searches trust every index so a damaged cache must not get this far
+  std::size_t stateCount = m_outputs.size();
+  auto validKeyword = [this](std::uint32_t keyword) { return keyword == NO_STATE || keyword < m_keywords.size(); };
+  auto validState = [stateCount](std::uint32_t state) { return state == NO_STATE || state < stateCount; };
+
+  bool valid = m_classCount > 0 && stateCount > 0 && m_transitions.size() == stateCount * m_classCount &&
+               m_ownOutputs.size() == stateCount && m_outputLinks.size() == stateCount && m_repeats.size() == m_keywords.size() &&
+               std::all_of(m_byteClasses.begin(), m_byteClasses.end(), [this](std::uint8_t byteClass) { return byteClass < m_classCount; }) &&
+               std::all_of(m_transitions.begin(), m_transitions.end(), [this](std::uint32_t next)
+                  {
+                    std::uint32_t row = next & ~MATCH_FLAG;
+                    return row < m_transitions.size() && row % m_classCount == 0 && (!(next & MATCH_FLAG) || m_outputs[row / m_classCount] != NO_STATE);
+                  }) &&
+               std::all_of(m_outputs.begin(), m_outputs.end(), validKeyword) &&
+               std::all_of(m_ownOutputs.begin(), m_ownOutputs.end(), validKeyword) &&
+               std::all_of(m_repeats.begin(), m_repeats.end(), validKeyword) &&
+               std::all_of(m_outputLinks.begin(), m_outputLinks.end(), validState);
+
+  if (!valid)
+    throw std::runtime_error("Pattern cache is corrupt");
+}
+
+/**********************************************************************
+ * save
+ *
+ * Description: Writes the tables so they can be loaded without
+ *      building the trie again
+ *
+ * Parameters:
+ *   writer: where to write the automaton
+ *********************************************************************/
+void AhoCorasick::save(CacheWriter& writer) const
+{
+  writer.write<std::uint64_t>(m_keywords.size());
+  for (const std::string& keyword : m_keywords)
+    writer.writeString(keyword);
+
+  writer.write(m_byteClasses);
+  writer.write(m_classCount);
+  writer.writeVector(m_transitions);
+  writer.writeVector(m_outputs);
+  writer.writeVector(m_ownOutputs);
+  writer.writeVector(m_outputLinks);
+  writer.writeVector(m_repeats);
+  writer.writeCharacterSet(m_startClass.characters());
+  writer.write<std::uint8_t>(m_skipStart);
+}
+
+/**********************************************************************
+ * find
+ *
+ * Description: Finds the keyword that ends first in the input
+ *
+ * Parameters:
+ *   input: the string to search
+ *   pos: the position to start searching at
+ *
+ * Returns: the position of the start of the keyword, npos if no
+ *      keyword is in the input
+ *********************************************************************/
+std::size_t AhoCorasick::find(std::string_view input, std::size_t pos) const
+{
+  std::size_t keyword;
+
+  return find(input, pos, keyword);
+}
+
+/**********************************************************************
+ * find
+ *
+ * Description: Finds the keyword that ends first in the input, when
+ *      several end at the same place the longest one is reported
+ *
+ * Parameters:
+ *   input: the string to search
+ *   pos: the position to start searching at
+ *   keyword: set to the index of the keyword that was found
+ *
+ * Returns: the position of the start of the keyword, npos if no
+ *      keyword is in the input
+ *********************************************************************/
+std::size_t AhoCorasick::find(std::string_view input, std::size_t pos, std::size_t& keyword) const
+{
+  const std::uint32_t* transitions = m_transitions.data();
+  std::uint32_t state = 0;
+
+  while (pos < input.size())
+  {
+    if (state == 0 && m_skipStart && (pos = m_startClass.find(input, pos)) == std::string_view::npos)
+      return std::string_view::npos;
+
+    state = transitions[state + m_byteClasses[static_cast<unsigned char>(input[pos++])]];
+
+    if (state & MATCH_FLAG)
+    {
+      state &= ~MATCH_FLAG;
+      keyword = m_outputs[state / m_classCount];
+
+      return pos - m_keywords[keyword].size();
+    }
+  }
+
+  return std::string_view::npos;
+}
+
+/**********************************************************************
+ * findAll
+ *
+ * Description: Finds every keyword that appears in the input, not just
+ *      the first one to end, by following the output links from each
+ *      state where a keyword ends
+ *
+ * Parameters:
+ *   input: the string to search
+ *   keywords: set to the index of each keyword found, in index order
+ *********************************************************************/
+void AhoCorasick::findAll(std::string_view input, std::vector<std::size_t>& keywords) const
+{
+  findAll(input, keywords, std::numeric_limits<std::size_t>::max());
+}
+
+/**********************************************************************
+ * findAll
+ *
+ * Description: Finds every keyword that appears in the input unless
+ *      there are too many, a caller that only wants a few can stop
+ *      reading once it knows there are more
+ *
+ * Parameters:
+ *   input: the string to search
+ *   keywords: set to the index of each keyword found, in index order
+ *   limit: the most keywords wanted
+ *
+ * Returns: false if more than limit different keywords were found,
+ *      keywords then only holds some of them
+ *********************************************************************/
+bool AhoCorasick::findAll(std::string_view input, std::vector<std::size_t>& keywords, std::size_t limit) const
+{
+  const std::uint32_t* transitions = m_transitions.data();
+  std::uint32_t state = 0;
+  std::size_t pos = 0;
+
+  std::vector<bool>& seen = t_seen;
+  bool complete = true;
+
+  keywords.clear();
+  if (seen.size() < m_keywords.size())
+    seen.resize(m_keywords.size());
+
+  while (pos < input.size() && complete)
+  {
+    if (state == 0 && m_skipStart && (pos = m_startClass.find(input, pos)) == std::string_view::npos)
+      break;
+
+    state = transitions[state + m_byteClasses[static_cast<unsigned char>(input[pos++])]];
+
+    if (state & MATCH_FLAG)
+    {
+      state &= ~MATCH_FLAG;
+
+      // a keyword found again adds nothing, so the list never outgrows the keywords
+      for (std::uint32_t output = state / m_classCount; output != NO_STATE; output = m_outputLinks[output])
+      {
+        for (std::uint32_t keyword = m_ownOutputs[output]; keyword != NO_STATE; keyword = m_repeats[keyword])
+        {
+          if (!seen[keyword])
+          {
+            seen[keyword] = true;
+            keywords.push_back(keyword);
+          }
+        }
+      }
+
+      complete = keywords.size() <= limit;
+    }
+  }
+
+  for (std::size_t keyword : keywords)
+    seen[keyword] = false;
+
+  if (!complete)
+    return false;
+
+  std::sort(keywords.begin(), keywords.end());
+
+  return true;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "CharacterClass.hpp"
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class CacheReader;
+class CacheWriter;
+
+// finds any of a set of literal keywords in one pass, the time per byte
+// doesn't depend on how many keywords there are
+class AhoCorasick
+{
+  public:
+    AhoCorasick(const std::vector<std::string>& keywords);
+    AhoCorasick(CacheReader& reader);
+    ~AhoCorasick() = default;
+
+    void save(CacheWriter& writer) const;
+
+    std::size_t find(std::string_view input, std::size_t pos = 0) const;
+    std::size_t find(std::string_view input, std::size_t pos, std::size_t& keyword) const;
+    void findAll(std::string_view input, std::vector<std::size_t>& keywords) const;
+    bool findAll(std::string_view input, std::vector<std::size_t>& keywords, std::size_t limit) const;
+
+    const std::vector<std::string>& keywords() const { return m_keywords; };
+
+  private:
+    std::vector<std::string> m_keywords;
+
+    // bytes that aren't in any keyword all share class 0
+    std::array<std::uint8_t, 256> m_byteClasses = {};
+    std::uint32_t m_classCount = 1;
+
+    // one row of m_classCount transitions per state, states are stored as the
+    // offset of their row and have MATCH_FLAG set when a keyword ends there
+    std::vector<std::uint32_t> m_transitions;
+
+    // the longest keyword ending at each state, indexed by row offset / m_classCount
+    std::vector<std::uint32_t> m_outputs;
+
+    // findAll needs every keyword, so each state also keeps the keyword that is its
+    // whole path and a link to the next shorter suffix state that has one of those
+    std::vector<std::uint32_t> m_ownOutputs;
+    std::vector<std::uint32_t> m_outputLinks;
+
+    // the next keyword with the same text, a repeated keyword only has one state
+    std::vector<std::uint32_t> m_repeats;
+
+    // bytes that can start a keyword, used to skip ahead from the start state
+    CharacterClass m_startClass;
+    bool m_skipStart = false;
+};
@@ -0,0 +1,156 @@
+#include "CharacterClass.hpp"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/**********************************************************************
+ * CharacterClass
+ *
+ * Description: Stores the bytes as a 256 bit table and splits it into
+ *      the nibble tables used by the vector search
+ *
+ * Parameters:
+ *   characters: the bytes in the class
+ *********************************************************************/
+CharacterClass::CharacterClass(const CharacterSet& characters)
+: m_characters(characters)
+{
+  for (int byte = 0; byte < 256; ++byte)
+  {
+    if (!m_characters[byte])
+      continue;
+
+    if (byte < 128)
+      m_lowRows[byte & 0x0f] |= 1 << (byte >> 4);
+    else
+      m_highRows[byte & 0x0f] |= 1 << ((byte >> 4) - 8);
+  }
+}
+
+/**********************************************************************
+ * digits / word
+ *
+ * Returns: the classes for \d and \w
+ *********************************************************************/
+CharacterClass CharacterClass::digits()
+{
+  CharacterSet characters;
+  for (int c = '0'; c <= '9'; ++c)
+    characters.set(c);
+
+  return CharacterClass(characters);
+}
+
+CharacterClass CharacterClass::word()
+{
+  CharacterSet characters;
+  for (int c = 0; c < 256; ++c)
+    characters[c] = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+
+  return CharacterClass(characters);
+}
+
+/**********************************************************************
+ * find
+ *
+ * Description: Finds the first byte in the class using the widest
+ *      vector instructions the CPU supports
+ *
+ * Parameters:
+ *   input: the string to search
+ *   pos: the position to start searching at
+ *
+ * Returns: the position of the byte, npos if there isn't one
+ *********************************************************************/
+std::size_t CharacterClass::find(std::string_view input, std::size_t pos) const
+{
+#if defined(__x86_64__)
+  static const bool haveAvx2 = __builtin_cpu_supports("avx2");
+  static const bool haveSsse3 = __builtin_cpu_supports("ssse3");
+
+  if (haveAvx2)
+    return findAvx2(input, pos);
+
+  if (haveSsse3)
+    return findSsse3(input, pos);
+#endif
+
+  return findScalar(input, pos);
+}
+
+/**********************************************************************
+ * find kernels
+ *
+ * Description: Look up every byte of a block at once, the low nibble
+ *      picks a row of the table with a shuffle and the high nibble picks
+ *      the bit in that row. The scalar version finishes the bytes left
+ *      over after the last full block
+ *********************************************************************/
+std::size_t CharacterClass::findScalar(std::string_view input, std::size_t pos) const
+{
+  for (; pos < input.size(); ++pos)
+  {
+    if (contains(input[pos]))
+      return pos;
+  }
+
+  return std::string_view::npos;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("ssse3")))
+std::size_t CharacterClass::findSsse3(std::string_view input, std::size_t pos) const
+{
+  const __m128i lowRows = _mm_loadu_si128(reinterpret_cast<const __m128i*>(m_lowRows.data()));
+  const __m128i highRows = _mm_loadu_si128(reinterpret_cast<const __m128i*>(m_highRows.data()));
+  const __m128i bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+  const __m128i nibble = _mm_set1_epi8(0x0f);
+
+  for (; pos + 16 <= input.size(); pos += 16)
+  {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input.data() + pos));
+    __m128i low = _mm_and_si128(block, nibble);
+    __m128i high = _mm_and_si128(_mm_srli_epi16(block, 4), nibble);
+
+    // bytes 0x80 and up use the high rows
+    __m128i isHigh = _mm_cmplt_epi8(block, _mm_setzero_si128());
+    __m128i row = _mm_or_si128(_mm_and_si128(isHigh, _mm_shuffle_epi8(highRows, low)), _mm_andnot_si128(isHigh, _mm_shuffle_epi8(lowRows, low)));
+    __m128i bit = _mm_shuffle_epi8(bits, high);
+
+    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(row, bit), bit));
+
+    if (mask != 0)
+      return pos + __builtin_ctz(mask);
+  }
+
+  return findScalar(input, pos);
+}
+
+__attribute__((target("avx2")))
+std::size_t CharacterClass::findAvx2(std::string_view input, std::size_t pos) const
+{
+  const __m256i lowRows = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(m_lowRows.data())));
+  const __m256i highRows = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(m_highRows.data())));
+  const __m256i bits = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128,
+                                        1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+
+  for (; pos + 32 <= input.size(); pos += 32)
+  {
+    __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input.data() + pos));
+    __m256i low = _mm256_and_si256(block, nibble);
+    __m256i high = _mm256_and_si256(_mm256_srli_epi16(block, 4), nibble);
+
+    __m256i row = _mm256_blendv_epi8(_mm256_shuffle_epi8(lowRows, low), _mm256_shuffle_epi8(highRows, low), block);
+    __m256i bit = _mm256_shuffle_epi8(bits, high);
+
+    unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(row, bit), bit));
+
+    if (mask != 0)
+      return pos + __builtin_ctz(mask);
+  }
+
+  return findSsse3(input, pos);
+}
+#endif
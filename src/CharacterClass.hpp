@@ -0,0 +1,36 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <string_view>
+
+using CharacterSet = std::bitset<256>;
+
+// a set of bytes that can be tested one at a time or searched for 16-32 bytes at once
+class CharacterClass
+{
+  public:
+    CharacterClass() = default;
+    CharacterClass(const CharacterSet& characters);
+
+    bool contains(char c) const { return m_characters[static_cast<unsigned char>(c)]; };
+    std::size_t find(std::string_view input, std::size_t pos = 0) const;
+
+    const CharacterSet& characters() const { return m_characters; };
+
+    static CharacterClass digits();
+    static CharacterClass word();
+
+  private:
+    std::size_t findScalar(std::string_view input, std::size_t pos) const;
+    std::size_t findSsse3(std::string_view input, std::size_t pos) const;
+    std::size_t findAvx2(std::string_view input, std::size_t pos) const;
+
+    CharacterSet m_characters;
+
+    // indexed by the low nibble of a byte, bit n is set if the byte with high nibble n
+    // (or n + 8 for the high rows) is in the class
+    alignas(16) std::array<std::uint8_t, 16> m_lowRows = {};
+    alignas(16) std::array<std::uint8_t, 16> m_highRows = {};
+};
@@ -0,0 +1,182 @@
+#include "GrepCore.hpp"
+#include "Patterns.hpp"
+
+/**********************************************************************
+ * findMatch
+ *
+ * Description: Finds the first match starting at or after from and
+ *      fills in its span and groups, the groups are overwritten in place
+ *      so stepping through many matches doesn't allocate
+ *
+ * Parameters:
+ *   pattern: the compiled pattern
+ *   input: the string to search, '^' and '$' only match at its ends
+ *   from: the first position a match may start at
+ *   match: set to the match found
+ *
+ * Returns: true if there was a match
+ *********************************************************************/
+static bool findMatch(const CompiledPattern& pattern, std::string_view input, std::size_t from, GrepMatch& match)
+{
+  MatchState state(pattern.groupCount());
+  std::size_t start;
+  std::size_t end = pattern.find(input, from, start, state);
+
+  if (end == std::string::npos)
+    return false;
+
+  match.start = start;
+  match.end = end;
+  match.groups.resize(pattern.groupCount() + 1);
+  match.groups[0] = input.substr(start, end - start);
+
+  for (std::size_t group = 0; group < pattern.groupCount(); ++group)
+  {
+    if (state[group].start == std::string::npos)
+      match.groups[group + 1].reset();
+    else
+      match.groups[group + 1] = input.substr(state[group].start, state[group].end - state[group].start);
+  }
+
+  return true;
+}
+
+/**********************************************************************
+ * GrepMatchIterator
+ *
+ * Parameters:
+ *   pattern: the compiled pattern, must outlive the iterator
+ *   input: the string to search, must outlive the iterator
+ *********************************************************************/
+GrepMatchIterator::GrepMatchIterator(const CompiledPattern& pattern, std::string_view input)
+: m_pattern(&pattern), m_input(input)
+{
+  find(0);
+}
+
+GrepMatchIterator& GrepMatchIterator::operator++()
+{
+  // an empty match would be found again at the same place
+  find(m_match.end == m_match.start ? m_match.end + 1 : m_match.end);
+
+  return *this;
+}
+
+void GrepMatchIterator::find(std::size_t from)
+{
+  if (!findMatch(*m_pattern, m_input, from, m_match))
+    m_pattern = nullptr;
+}
+
+/**********************************************************************
+ * GrepPattern
+ *
+ * Description: Compiles a pattern, throws std::runtime_error if it
+ *      can't be parsed
+ *
+ * Parameters:
+ *   pattern: the pattern
+ *********************************************************************/
+GrepPattern::GrepPattern(std::string_view pattern)
+: m_compiled(std::make_unique<CompiledPattern>(std::string(pattern)))
+{
+}
+
+/**********************************************************************
+ * GrepPattern
+ *
+ * Description: Compiles patterns that are searched for together,
+ *      matchingPatterns() reports them by index
+ *
+ * Parameters:
+ *   patternSet: the patterns
+ *********************************************************************/
+GrepPattern::GrepPattern(const std::vector<std::string>& patternSet)
+: m_compiled(std::make_unique<CompiledPattern>(patternSet))
+{
+}
+
+GrepPattern::~GrepPattern() = default;
+GrepPattern::GrepPattern(GrepPattern&& other) noexcept = default;
+GrepPattern& GrepPattern::operator=(GrepPattern&& other) noexcept = default;
+
+/**********************************************************************
+ * matches
+ *
+ * Parameters:
+ *   input: the string to search
+ *
+ * Returns: true if the pattern is anywhere in the input
+ *********************************************************************/
+bool GrepPattern::matches(std::string_view input) const
+{
+  return m_compiled->matches(input);
+}
+
+/**********************************************************************
+ * find
+ *
+ * Parameters:
+ *   input: the string to search, '^' and '$' only match at its ends
+ *   from: the first position a match may start at
+ *
+ * Returns: the first match starting at or after from, if any
+ *********************************************************************/
+std::optional<GrepMatch> GrepPattern::find(std::string_view input, std::size_t from) const
+{
+  GrepMatch match;
+
+  if (!findMatch(*m_compiled, input, from, match))
+    return std::nullopt;
+
+  return match;
+}
+
+/**********************************************************************
+ * findAll
+ *
+ * Description: Collects what findEach() steps through
+ *
+ * Parameters:
+ *   input: the string to search
+ *
+ * Returns: every match that doesn't overlap an earlier one, in the
+ *      order they appear
+ *********************************************************************/
+std::vector<GrepMatch> GrepPattern::findAll(std::string_view input) const
+{
+  std::vector<GrepMatch> matches;
+
+  for (const GrepMatch& match : findEach(input))
+    matches.push_back(match);
+
+  return matches;
+}
+
+/**********************************************************************
+ * matchingPatterns
+ *
+ * Parameters:
+ *   input: the string to search
+ *
+ * Returns: the index of every pattern of the set found in the input,
+ *      a single pattern is pattern 0
+ *********************************************************************/
+std::vector<std::size_t> GrepPattern::matchingPatterns(std::string_view input) const
+{
+  std::vector<std::size_t> patterns;
+  m_compiled->matchingPatterns(input, patterns);
+
+  return patterns;
+}
+
+/**********************************************************************
+ * groupCount
+ *
+ * Returns: how many groups the pattern has, every group of every
+ *      pattern in a set
+ *********************************************************************/
+std::size_t GrepPattern::groupCount() const
+{
+  return m_compiled->groupCount();
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+// the public interface of the grepcore library, the only header an embedding
+// program needs, none of the matcher's own types appear here so they can
+// change without breaking callers
+
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class CompiledPattern;
+
+// one match, the views point into the input that was searched
+struct GrepMatch
+{
+  std::size_t start = 0;
+  std::size_t end = 0;
+
+  // groups[0] is the whole match, groups[n] is what \n would match, empty
+  // when the group took no part in the match
+  std::vector<std::optional<std::string_view>> groups;
+
+  std::string_view text() const { return *groups[0]; };
+};
+
+// steps through every match that doesn't overlap an earlier one, the
+// pattern isn't compiled again and the match is reused between steps.
+// After an empty match the next one is looked for a byte further on
+class GrepMatchIterator
+{
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = GrepMatch;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const GrepMatch*;
+    using reference = const GrepMatch&;
+
+    GrepMatchIterator() = default;
+    GrepMatchIterator(const CompiledPattern& pattern, std::string_view input);
+
+    const GrepMatch& operator*() const { return m_match; };
+    const GrepMatch* operator->() const { return &m_match; };
+
+    GrepMatchIterator& operator++();
+    void operator++(int) { ++*this; };
+
+    bool operator==(std::default_sentinel_t) const { return m_pattern == nullptr; };
+
+  private:
+    void find(std::size_t from);
+
+    const CompiledPattern* m_pattern = nullptr; // null once there are no more matches
+    std::string_view m_input;
+    GrepMatch m_match;
+};
+
+// the matches in one input, for range based for loops
+class GrepMatches
+{
+  public:
+    GrepMatches(const CompiledPattern& pattern, std::string_view input) : m_pattern(pattern), m_input(input) {};
+
+    GrepMatchIterator begin() const { return GrepMatchIterator(m_pattern, m_input); };
+    std::default_sentinel_t end() const { return std::default_sentinel; };
+
+  private:
+    const CompiledPattern& m_pattern;
+    std::string_view m_input;
+};
+
+class GrepPattern
+{
+  public:
+    GrepPattern(std::string_view pattern);
+    GrepPattern(const std::vector<std::string>& patternSet);
+    ~GrepPattern();
+
+    GrepPattern(GrepPattern&& other) noexcept;
+    GrepPattern& operator=(GrepPattern&& other) noexcept;
+
+    bool matches(std::string_view input) const;
+    std::optional<GrepMatch> find(std::string_view input, std::size_t from = 0) const;
+    std::vector<GrepMatch> findAll(std::string_view input) const;
+    GrepMatches findEach(std::string_view input) const { return GrepMatches(*m_compiled, input); };
+    std::vector<std::size_t> matchingPatterns(std::string_view input) const;
+
+    std::size_t groupCount() const;
+
+  private:
+    std::unique_ptr<CompiledPattern> m_compiled;
+};
@@ -0,0 +1,71 @@
+#include "MappedFile.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**********************************************************************
+ * MappedFile
+ *
+ * Description: Opens the file and maps all of it into memory so it can
+ *      be searched without copying, the kernel is told it will be read
+ *      from start to end so it reads ahead aggressively
+ *
+ * Parameters:
+ *   path: the file to map
+ *********************************************************************/
+MappedFile::MappedFile(const std::string& path)
+{
+  m_descriptor = ::open(path.c_str(), O_RDONLY);
+  if (m_descriptor < 0)
+    throw std::runtime_error(path + ": " + std::strerror(errno));
+
+  struct stat status;
+  if (::fstat(m_descriptor, &status) != 0)
+  {
+    int error = errno;
+    ::close(m_descriptor);
+    throw std::runtime_error(path + ": " + std::strerror(error));
+  }
+
+  if (S_ISDIR(status.st_mode))
+  {
+    ::close(m_descriptor);
+    throw std::runtime_error(path + ": Is a directory");
+  }
+
+  // only regular files can be mapped
+  if (!S_ISREG(status.st_mode))
+    return;
+
+  // empty files have nothing to map but are still fully available
+  m_mapped = true;
+  if (status.st_size == 0)
+    return;
+
+  m_data = ::mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, m_descriptor, 0);
+  if (m_data == MAP_FAILED)
+  {
+    m_data = nullptr;
+    m_mapped = false;
+    return;
+  }
+
+  m_size = status.st_size;
+
+  ::madvise(m_data, m_size, MADV_SEQUENTIAL);
+}
+
+MappedFile::~MappedFile()
+{
+  if (m_data)
+    ::munmap(m_data, m_size);
+
+  if (m_descriptor >= 0)
+    ::close(m_descriptor);
+}
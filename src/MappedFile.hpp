@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+class MappedFile
+{
+  public:
+    MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    std::string_view data() const { return std::string_view(static_cast<const char*>(m_data), m_size); };
+
+    // false when the file can't be mapped (pipes, devices) and must be read instead
+    bool is_mapped() const { return m_mapped; };
+
+  private:
+    int m_descriptor = -1;
+    void* m_data = nullptr;
+    std::size_t m_size = 0;
+    bool m_mapped = false;
+};
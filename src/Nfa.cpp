@@ -0,0 +1,1416 @@
+#include "Nfa.hpp"
+#include "PatternCache.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+// the DFA cache is thrown away and rebuilt once it holds this many states
+constexpr std::size_t MAX_DFA_STATES = 4096;
+
+// nested counted repeats multiply the states, past this the pattern is refused
+constexpr std::size_t MAX_NFA_STATES = 1 << 20;
+
+// skipping ahead only pays off when few bytes can start a match
+constexpr std::size_t MAX_SKIP_CHARACTERS = 32;
+
+struct DfaState
+{
+  std::vector<int> nfaStates;
+  std::vector<int> matches;    // the patterns whose match state is in the set
+  std::vector<int> endMatches; // the patterns matched once the end of the input is reached
+  bool isMatch = false;
+  int endMatch = -1; // -1 not computed yet, otherwise 0 or 1
+};
+
+// a step of following a thread's empty moves while recording captures, a
+// frame with a slot puts back the value the slot had before a Save and an
+// exit frame follows the second branch of the split in state
+struct CaptureFrame
+{
+  int state = -1;
+  int slot = -1;
+  std::size_t value = 0;
+  bool exit = false;
+};
+
+// scratch space for a single find/matches call at a time
+struct NfaCache
+{
+  // pike VM thread lists and the marks used to avoid adding a state twice
+  std::vector<int> currentList, nextList, stack;
+  std::vector<std::uint32_t> marks;
+  std::uint32_t generation = 0;
+
+  // the capture slots of each thread in the lists, one run of slots after another
+  std::vector<std::size_t> currentCaptures, nextCaptures, threadCaptures;
+  std::vector<CaptureFrame> captureStack;
+  std::vector<char> pendingExits;
+
+  // patterns already reported by matchingPatterns, marked with that call's generation
+  std::vector<std::uint32_t> patternMarks;
+  std::uint32_t patternGeneration = 0;
+
+  // lazily built DFA, transitions holds one row of byte classes per state
+  std::vector<DfaState> dfaStates;
+  std::vector<int> transitions;
+  std::map<std::vector<int>, int> dfaLookup;
+  int dfaStart = -1;
+  int dfaRestart = -1;
+
+  void nextGeneration()
+  {
+    if (++generation == 0)
+    {
+      std::fill(marks.begin(), marks.end(), 0);
+      generation = 1;
+    }
+  }
+};
+
+// ids are never reused so a thread's cache can't be mistaken for one of a later NFA
+static std::atomic<std::uint64_t> s_nextId = 1;
+
+// the cache of the NFA this thread searched with most recently
+struct ThreadCache
+{
+  std::uint64_t owner = 0;
+  std::weak_ptr<const bool> ownerAlive;
+  std::unique_ptr<NfaCache> cache;
+};
+
+static thread_local ThreadCache t_cache;
+
+/**********************************************************************
+ * Nfa
+ *
+ * Description: Creates an empty NFA, fragments are added by the
+ *      patterns then connected with finish()
+ *********************************************************************/
+Nfa::Nfa()
+: m_states(), m_classRepresentatives(), m_caches(), m_id(s_nextId++), m_alive(std::make_shared<const bool>(true))
+{
+}
+
+/**********************************************************************
+ * Nfa
+ *
+ * Description: Rebuilds a finished NFA written by save(), the lazy DFA
+ *      starts out empty just like a freshly built one
+ *
+ * Parameters:
+ *   reader: the cache positioned at the NFA
+ *********************************************************************/
+Nfa::Nfa(CacheReader& reader)
+: m_states(), m_classRepresentatives(), m_caches(), m_id(s_nextId++), m_alive(std::make_shared<const bool>(true))
+{
+  // each state is an op, two links and a character set
+  m_states.resize(reader.readCount(sizeof(std::uint8_t) + 2 * sizeof(std::int32_t) + 4 * sizeof(std::uint64_t)));
+
+  for (NfaState& state : m_states)
+  {
+    state.op = static_cast<NfaOp>(reader.read<std::uint8_t>());
+    state.out = reader.read<std::int32_t>();
+    state.out1 = reader.read<std::int32_t>();
+    state.characters = reader.readCharacterSet();
+  }
+
+  m_start = reader.read<std::int32_t>();
+  m_patternCount = reader.read<std::uint64_t>();
+  m_patternStarts = reader.readVector<int>();
+  m_byteClasses = reader.read<std::array<std::uint8_t, 256>>();
+  m_classRepresentatives = reader.readVector<std::uint8_t>();
+  m_restartClass = CharacterClass(reader.readCharacterSet());
+  m_skipRestart = reader.read<std::uint8_t>();
+  m_anchored = reader.read<std::uint8_t>();
+
+  // the searches trust every index so a damaged cache must not get this far
+  auto validState = [this](int state) { return state >= 0 && state < static_cast<int>(m_states.size()); };
+
+  for (const NfaState& state : m_states)
+  {
+    if (state.op > NfaOp::Save ||
+        (state.op == NfaOp::Match ? state.out < 0 || state.out >= static_cast<int>(m_patternCount) : !validState(state.out)) ||
+        (state.op == NfaOp::Split && !validState(state.out1)) || (state.op == NfaOp::Save && state.out1 < 0))
+      throw std::runtime_error("Pattern cache is corrupt");
+  }
+
+  if (!validState(m_start) || m_patternCount == 0 || m_patternStarts.size() != m_patternCount ||
+      !std::all_of(m_patternStarts.begin(), m_patternStarts.end(), validState) ||
+      std::any_of(m_byteClasses.begin(), m_byteClasses.end(), [this](std::uint8_t byteClass) { return byteClass >= m_classRepresentatives.size(); }))
+    throw std::runtime_error("Pattern cache is corrupt");
+}
+
+/**********************************************************************
+ * Nfa
+ *
+ * Description: Copies one pattern out of a finished NFA for a pattern
+ *      set so it can be searched for on its own, its lazy DFA only
+ *      holds that pattern's states
+ *
+ * Parameters:
+ *   patternSet: the NFA with every pattern
+ *   pattern: the index of the pattern to copy
+ *********************************************************************/
+Nfa::Nfa(const Nfa& patternSet, std::size_t pattern)
+: m_states(), m_classRepresentatives(), m_caches(), m_id(s_nextId++), m_alive(std::make_shared<const bool>(true))
+{
+  // the reachable states are numbered in the order they are found, only a
+  // few of the set's states are reachable so they are looked up in a map
+  std::unordered_map<int, int> renumber;
+  std::vector<int> original{patternSet.m_patternStarts[pattern]};
+  renumber[original[0]] = 0;
+
+  for (std::size_t next = 0; next < original.size(); ++next)
+  {
+    const NfaState& state = patternSet.m_states[original[next]];
+
+    if (state.op == NfaOp::Match)
+      continue;
+
+    for (int exit : {state.out, state.op == NfaOp::Split ? state.out1 : -1})
+    {
+      if (exit >= 0 && renumber.emplace(exit, original.size()).second)
+        original.push_back(exit);
+    }
+  }
+
+  for (int index : original)
+  {
+    NfaState state = patternSet.m_states[index];
+
+    if (state.op == NfaOp::Match)
+      state.out = 0;
+    else
+      state.out = renumber[state.out];
+
+    if (state.op == NfaOp::Split)
+      state.out1 = renumber[state.out1];
+
+    m_states.push_back(state);
+  }
+
+  m_start = 0;
+  m_patternCount = 1;
+  m_patternStarts.assign(1, 0);
+
+  computeSearchTables();
+}
+
+Nfa::~Nfa() = default;
+
+/**********************************************************************
+ * save
+ *
+ * Description: Writes the finished NFA so it can be loaded without
+ *      parsing the pattern again
+ *
+ * Parameters:
+ *   writer: where to write the NFA
+ *********************************************************************/
+void Nfa::save(CacheWriter& writer) const
+{
+  writer.write<std::uint64_t>(m_states.size());
+
+  for (const NfaState& state : m_states)
+  {
+    writer.write<std::uint8_t>(static_cast<std::uint8_t>(state.op));
+    writer.write<std::int32_t>(state.out);
+    writer.write<std::int32_t>(state.out1);
+    writer.writeCharacterSet(state.characters);
+  }
+
+  writer.write<std::int32_t>(m_start);
+  writer.write<std::uint64_t>(m_patternCount);
+  writer.writeVector(m_patternStarts);
+  writer.write(m_byteClasses);
+  writer.writeVector(m_classRepresentatives);
+  writer.writeCharacterSet(m_restartClass.characters());
+  writer.write<std::uint8_t>(m_skipRestart);
+  writer.write<std::uint8_t>(m_anchored);
+}
+
+/**********************************************************************
+ * Nfa Fragment builders
+ *
+ * Description: Add the states for a single piece of the pattern and
+ *     return it with its exits still unconnected
+ *
+ * Parameters:
+ *   characters: the bytes accepted by a character state
+ *   first, second, fragment: previously built fragments to combine
+ *
+ * Returns: the new fragment
+ *********************************************************************/
+Nfa::Fragment Nfa::character(const CharacterSet& characters)
+{
+  int state = addState(NfaOp::Character);
+  m_states[state].characters = characters;
+
+  return Fragment{state, {state * 2}};
+}
+
+Nfa::Fragment Nfa::assertStart()
+{
+  int state = addState(NfaOp::AssertStart);
+
+  return Fragment{state, {state * 2}};
+}
+
+Nfa::Fragment Nfa::assertEnd()
+{
+  int state = addState(NfaOp::AssertEnd);
+
+  return Fragment{state, {state * 2}};
+}
+
+Nfa::Fragment Nfa::empty()
+{
+  int state = addState(NfaOp::Jump);
+
+  return Fragment{state, {state * 2}};
+}
+
+Nfa::Fragment Nfa::save(int slot)
+{
+  int state = addState(NfaOp::Save, -1, slot);
+
+  return Fragment{state, {state * 2}};
+}
+
+Nfa::Fragment Nfa::concatenate(const Fragment& first, const Fragment& second)
+{
+  patch(first.holes, second.start);
+
+  return Fragment{first.start, second.holes};
+}
+
+Nfa::Fragment Nfa::alternate(const Fragment& first, const Fragment& second)
+{
+  int state = addState(NfaOp::Split, first.start, second.start);
+
+  Fragment result{state, first.holes};
+  result.holes.insert(result.holes.end(), second.holes.begin(), second.holes.end());
+
+  return result;
+}
+
+Nfa::Fragment Nfa::oneOrMore(const Fragment& fragment, bool lazy)
+{
+  // greedy prefers going around the loop again, lazy prefers leaving it
+  int state = lazy ? addState(NfaOp::Split, -1, fragment.start) : addState(NfaOp::Split, fragment.start);
+  patch(fragment.holes, state);
+
+  return Fragment{fragment.start, {lazy ? state * 2 : state * 2 + 1}};
+}
+
+Nfa::Fragment Nfa::optional(const Fragment& fragment, bool lazy)
+{
+  int state = lazy ? addState(NfaOp::Split, -1, fragment.start) : addState(NfaOp::Split, fragment.start);
+
+  Fragment result{state, fragment.holes};
+  result.holes.push_back(lazy ? state * 2 : state * 2 + 1);
+
+  return result;
+}
+
+/**********************************************************************
+ * finish
+ *
+ * Description: Connects the final fragment to the match state so the
+ *      NFA is ready to be searched
+ *
+ * Parameters:
+ *   fragment: the fragment for the whole pattern
+ *********************************************************************/
+void Nfa::finish(const Fragment& fragment)
+{
+  finish(std::vector<Fragment>{fragment});
+}
+
+/**********************************************************************
+ * finish
+ *
+ * Description: Connects each pattern's fragment to its own match state
+ *      and starts them all together so one search runs every pattern
+ *
+ * Parameters:
+ *   fragments: the fragment for each pattern, in priority order
+ *********************************************************************/
+void Nfa::finish(const std::vector<Fragment>& fragments)
+{
+  for (std::size_t pattern = 0; pattern < fragments.size(); ++pattern)
+    patch(fragments[pattern].holes, addState(NfaOp::Match, static_cast<int>(pattern)));
+
+  m_start = fragments.back().start;
+  for (std::size_t pattern = fragments.size() - 1; pattern > 0; --pattern)
+    m_start = addState(NfaOp::Split, fragments[pattern-1].start, m_start);
+
+  m_patternCount = fragments.size();
+
+  for (const Fragment& fragment : fragments)
+    m_patternStarts.push_back(fragment.start);
+
+  computeSearchTables();
+}
+
+/**********************************************************************
+ * computeSearchTables
+ *
+ * Description: Works out the byte classes and the bytes a match can
+ *      start with once the states are complete
+ *********************************************************************/
+void Nfa::computeSearchTables()
+{
+  computeByteClasses();
+
+  // the bytes that move the search out of the state where nothing is partly matched
+  NfaCache scratch;
+  std::vector<int> restart;
+  CharacterSet restartCharacters;
+
+  scratch.marks.assign(m_states.size(), 0);
+  scratch.nextGeneration();
+  closure(scratch, restart, m_start, false, false);
+
+  for (int state : restart)
+  {
+    if (m_states[state].op == NfaOp::Character)
+      restartCharacters |= m_states[state].characters;
+  }
+
+  m_restartClass = CharacterClass(restartCharacters);
+  m_skipRestart = restartCharacters.count() <= MAX_SKIP_CHARACTERS;
+
+  // not even a '$' is left once past the start, every match starts at 0
+  m_anchored = restart.empty();
+}
+
+/**********************************************************************
+ * addState
+ *
+ * Description: Appends a new state to the NFA
+ *
+ * Returns: the index of the new state
+ *********************************************************************/
+int Nfa::addState(NfaOp op, int out, int out1)
+{
+  if (m_states.size() >= MAX_NFA_STATES)
+    throw std::runtime_error("Pattern is too large");
+
+  m_states.push_back(NfaState{op, out, out1, CharacterSet()});
+
+  return m_states.size() - 1;
+}
+
+/**********************************************************************
+ * patch
+ *
+ * Description: Points all of the holes at the target state, a hole is
+ *      the state index times two plus one when it is the out1 exit
+ *********************************************************************/
+void Nfa::patch(const std::vector<int>& holes, int target)
+{
+  for (int hole : holes)
+  {
+    if (hole % 2)
+      m_states[hole / 2].out1 = target;
+    else
+      m_states[hole / 2].out = target;
+  }
+}
+
+/**********************************************************************
+ * computeByteClasses
+ *
+ * Description: Splits the 256 bytes into the fewest classes where every
+ *      byte in a class is accepted by exactly the same states
+ *********************************************************************/
+void Nfa::computeByteClasses()
+{
+  int classCount = 1;
+  m_byteClasses.fill(0);
+
+  for (const NfaState& state : m_states)
+  {
+    if (state.op != NfaOp::Character)
+      continue;
+
+    // every class is split into the bytes inside and outside this set
+    std::vector<int> inside(classCount, -1), outside(classCount, -1);
+    int newCount = 0;
+
+    for (int byte = 0; byte < 256; ++byte)
+    {
+      std::vector<int>& split = state.characters[byte] ? inside : outside;
+      int& newClass = split[m_byteClasses[byte]];
+
+      if (newClass < 0)
+        newClass = newCount++;
+
+      m_byteClasses[byte] = newClass;
+    }
+
+    classCount = newCount;
+  }
+
+  m_classRepresentatives.assign(classCount, 0);
+  for (int byte = 255; byte >= 0; --byte)
+    m_classRepresentatives[m_byteClasses[byte]] = byte;
+}
+
+/**********************************************************************
+ * find
+ *
+ * Description: Runs every possible path through the NFA at once (pike
+ *      VM) keeping them in priority order so the result is the same
+ *      as a greedy backtracking search but in linear time
+ *
+ * Parameters:
+ *   input: the string to search for the pattern
+ *   startsWith: Whether or not the input must start with the pattern
+ *
+ * Returns: the position after the first match in the input, npos if
+ *      there is no match
+ *********************************************************************/
+std::size_t Nfa::find(std::string_view input, bool startsWith) const
+{
+#if GREP_STATS
+  StatsTimer timer(m_pikeStats);
+#endif
+
+  std::unique_ptr<NfaCache> cache = checkoutCache();
+  std::vector<int>& currentList = cache->currentList;
+  std::vector<int>& nextList = cache->nextList;
+  std::size_t result = std::string::npos;
+  std::size_t pos = 0;
+
+  currentList.clear();
+  cache->nextGeneration();
+
+  for (; pos <= input.size(); ++pos)
+  {
+    // a new attempt starts at every position until something matched
+    if (result == std::string::npos && (!startsWith || pos == 0))
+      addThread(*cache, currentList, m_start, pos, input.size());
+
+    // nothing left to try once a match or the only attempt is finished
+    if (currentList.empty() && (result != std::string::npos || startsWith || m_anchored))
+      break;
+
+    nextList.clear();
+    cache->nextGeneration();
+
+    for (int state : currentList)
+    {
+      const NfaState& nfaState = m_states[state];
+
+      if (nfaState.op == NfaOp::Match)
+      {
+        // everything after this thread has a lower priority so drop them
+        result = pos;
+        break;
+      }
+
+      if (pos < input.size() && nfaState.characters[static_cast<unsigned char>(input[pos])])
+        addThread(*cache, nextList, nfaState.out, pos + 1, input.size());
+    }
+
+    std::swap(currentList, nextList);
+  }
+
+#if GREP_STATS
+  m_pikeStats.bytes.add(std::min(pos, input.size()));
+#endif
+
+  returnCache(std::move(cache));
+
+  return result;
+}
+
+/**********************************************************************
+ * find
+ *
+ * Description: Runs the pike VM like find() above but every thread also
+ *      carries the positions its Save states recorded, so the first
+ *      match comes out with where it starts and what its groups
+ *      captured, still in linear time
+ *
+ * Parameters:
+ *   input: the string to search, anchors refer to its ends
+ *   from: the first position a match may start at
+ *   captures: sized by the caller to two slots per group plus two for
+ *       the whole match, set to the start and end of each. npos for a
+ *       group that took no part
+ *
+ * Returns: the position after the first match, npos if there is none
+ *********************************************************************/
+std::size_t Nfa::find(std::string_view input, std::size_t from, std::vector<std::size_t>& captures) const
+{
+#if GREP_STATS
+  StatsTimer timer(m_pikeStats);
+#endif
+
+  std::unique_ptr<NfaCache> cache = checkoutCache();
+  std::vector<int>& currentList = cache->currentList;
+  std::vector<int>& nextList = cache->nextList;
+  std::vector<std::size_t>& threadCaptures = cache->threadCaptures;
+  std::size_t slots = captures.size();
+  std::size_t result = std::string::npos;
+  std::size_t pos = from;
+
+  currentList.clear();
+  cache->currentCaptures.clear();
+  cache->nextGeneration();
+
+  for (; pos <= input.size(); ++pos)
+  {
+    // nothing is partly matched so jump to the next byte that could start a match, the first
+    // attempt would have matched if the restart states could without a byte. The marks left by
+    // threads that died on an anchor belong to the position jumped from
+    if (result == std::string::npos && currentList.empty() && pos > from && m_skipRestart)
+    {
+      std::size_t next = m_restartClass.find(input, pos);
+      next = next == std::string_view::npos ? input.size() : next;
+
+      if (next != pos)
+      {
+        pos = next;
+        cache->nextGeneration();
+      }
+    }
+
+    // a new attempt starts at every position until something matched, slot 0 is where it started
+    if (result == std::string::npos)
+    {
+      threadCaptures.assign(slots, std::string::npos);
+      threadCaptures[0] = pos;
+      addCaptureThread(*cache, currentList, cache->currentCaptures, m_start, pos, input.size());
+    }
+
+    if (currentList.empty() && (result != std::string::npos || m_anchored))
+      break;
+
+    nextList.clear();
+    cache->nextCaptures.clear();
+    cache->nextGeneration();
+
+    for (std::size_t thread = 0; thread < currentList.size(); ++thread)
+    {
+      const NfaState& nfaState = m_states[currentList[thread]];
+      auto threadSlots = cache->currentCaptures.begin() + thread * slots;
+
+      if (nfaState.op == NfaOp::Match)
+      {
+        // everything after this thread has a lower priority so drop them
+        std::copy(threadSlots, threadSlots + slots, captures.begin());
+        captures[1] = pos;
+        result = pos;
+        break;
+      }
+
+      if (pos < input.size() && nfaState.characters[static_cast<unsigned char>(input[pos])])
+      {
+        threadCaptures.assign(threadSlots, threadSlots + slots);
+        addCaptureThread(*cache, nextList, cache->nextCaptures, nfaState.out, pos + 1, input.size());
+      }
+    }
+
+    std::swap(currentList, nextList);
+    std::swap(cache->currentCaptures, cache->nextCaptures);
+  }
+
+#if GREP_STATS
+  m_pikeStats.bytes.add(std::min(pos, input.size()) - std::min(from, input.size()));
+#endif
+
+  returnCache(std::move(cache));
+
+  return result;
+}
+
+/**********************************************************************
+ * addCaptureThread
+ *
+ * Description: Adds the state and every state reachable from it without
+ *      consuming input to the list like addThread(), each one added
+ *      with the captures recorded on the way to it
+ *
+ * Parameters:
+ *   cache: scratch space, threadCaptures holds the captures of the
+ *       thread being followed and is left as it was
+ *   list: the list of states waiting for the next byte
+ *   captures: the captures of each state in the list
+ *   state: the state to add
+ *   pos: the position in the input the list is for
+ *   size: the size of the input
+ *********************************************************************/
+void Nfa::addCaptureThread(NfaCache& cache, std::vector<int>& list, std::vector<std::size_t>& captures, int state, std::size_t pos, std::size_t size) const
+{
+  std::vector<CaptureFrame>& stack = cache.captureStack;
+  std::vector<std::size_t>& threadCaptures = cache.threadCaptures;
+  std::vector<char>& pendingExits = cache.pendingExits;
+  stack.assign(1, CaptureFrame{state});
+
+  while (!stack.empty())
+  {
+    CaptureFrame frame = stack.back();
+    stack.pop_back();
+
+    if (frame.slot >= 0)
+    {
+      threadCaptures[frame.slot] = frame.value;
+      continue;
+    }
+
+    state = frame.state;
+
+    if (frame.exit)
+    {
+      // already taken by an empty trip around the loop
+      if (!pendingExits[state])
+        continue;
+      pendingExits[state] = 0;
+      state = m_states[state].out1;
+    }
+
+    if (cache.marks[state] == cache.generation)
+    {
+      // back at a split whose first branch is still being followed, so a loop
+      // went around without consuming anything, like a backtracker it stops
+      // looping and leaves with the captures of that empty pass
+      if (m_states[state].op == NfaOp::Split && pendingExits[state])
+      {
+        pendingExits[state] = 0;
+        stack.push_back(CaptureFrame{m_states[state].out1});
+      }
+      continue;
+    }
+    cache.marks[state] = cache.generation;
+
+    const NfaState& nfaState = m_states[state];
+
+    switch (nfaState.op)
+    {
+      case NfaOp::Split:
+        // pushed in reverse so out is explored first
+        pendingExits[state] = 1;
+        stack.push_back(CaptureFrame{state, -1, 0, true});
+        stack.push_back(CaptureFrame{nfaState.out});
+        break;
+      case NfaOp::Jump:
+        stack.push_back(CaptureFrame{nfaState.out});
+        break;
+      case NfaOp::Save:
+        // the old value comes back once everything reached through here has been added
+        if (static_cast<std::size_t>(nfaState.out1) < threadCaptures.size())
+        {
+          stack.push_back(CaptureFrame{-1, nfaState.out1, threadCaptures[nfaState.out1]});
+          threadCaptures[nfaState.out1] = pos;
+        }
+        stack.push_back(CaptureFrame{nfaState.out});
+        break;
+      case NfaOp::AssertStart:
+        if (pos == 0)
+          stack.push_back(CaptureFrame{nfaState.out});
+        break;
+      case NfaOp::AssertEnd:
+        if (pos == size)
+          stack.push_back(CaptureFrame{nfaState.out});
+        break;
+      case NfaOp::Character:
+      case NfaOp::Match:
+        list.push_back(state);
+        captures.insert(captures.end(), threadCaptures.begin(), threadCaptures.end());
+        break;
+    }
+  }
+}
+
+/**********************************************************************
+ * addThread
+ *
+ * Description: Adds the state and every state reachable from it without
+ *      consuming input to the list, in priority order
+ *
+ * Parameters:
+ *   cache: scratch space holding the marks for this list
+ *   list: the list of states waiting for the next byte
+ *   state: the state to add
+ *   pos: the position in the input the list is for
+ *   size: the size of the input
+ *********************************************************************/
+void Nfa::addThread(NfaCache& cache, std::vector<int>& list, int state, std::size_t pos, std::size_t size) const
+{
+  std::vector<int>& stack = cache.stack;
+  stack.assign(1, state);
+
+  while (!stack.empty())
+  {
+    state = stack.back();
+    stack.pop_back();
+
+    if (cache.marks[state] == cache.generation)
+      continue;
+    cache.marks[state] = cache.generation;
+
+    const NfaState& nfaState = m_states[state];
+
+    switch (nfaState.op)
+    {
+      case NfaOp::Split:
+        // pushed in reverse so out is explored first
+        stack.push_back(nfaState.out1);
+        stack.push_back(nfaState.out);
+        break;
+      case NfaOp::Jump:
+      case NfaOp::Save:
+        stack.push_back(nfaState.out);
+        break;
+      case NfaOp::AssertStart:
+        if (pos == 0)
+          stack.push_back(nfaState.out);
+        break;
+      case NfaOp::AssertEnd:
+        if (pos == size)
+          stack.push_back(nfaState.out);
+        break;
+      case NfaOp::Character:
+      case NfaOp::Match:
+        list.push_back(state);
+        break;
+    }
+  }
+}
+
+/**********************************************************************
+ * matches
+ *
+ * Description: Checks if the pattern appears anywhere in the input by
+ *      walking a DFA that is built from the NFA as it is needed, each
+ *      byte costs a single table lookup once the DFA is warm
+ *
+ * Parameters:
+ *   input: the string to search for the pattern
+ *
+ * Returns: true if the pattern was found
+ *********************************************************************/
+bool Nfa::matches(std::string_view input) const
+{
+  // the start state can only see the end anchor when there is no input
+  if (input.empty())
+    return find(input) != std::string::npos;
+
+#if GREP_STATS
+  StatsTimer timer(m_dfaStats);
+#endif
+
+  std::unique_ptr<NfaCache> cache = checkoutCache();
+  int state = dfaStartState(*cache);
+  int restart = dfaRestartState(*cache);
+  bool found = cache->dfaStates[state].isMatch;
+  std::size_t pos = 0;
+
+  for (; pos < input.size() && !found; ++pos)
+  {
+    // nothing is partly matched so jump to the next byte that could start a match
+    if (state == restart && m_skipRestart && (pos = m_restartClass.find(input, pos)) == std::string_view::npos)
+      break;
+
+    int byteClass = m_byteClasses[static_cast<unsigned char>(input[pos])];
+    int next = cache->transitions[state * m_classRepresentatives.size() + byteClass];
+
+    if (next < 0)
+    {
+      next = dfaNextState(*cache, state, byteClass);
+      restart = dfaRestartState(*cache);
+    }
+
+    state = next;
+    found = cache->dfaStates[state].isMatch;
+  }
+
+  if (!found)
+    found = dfaEndMatch(*cache, state);
+
+#if GREP_STATS
+  m_dfaStats.bytes.add(std::min(pos, input.size()));
+#endif
+
+  returnCache(std::move(cache));
+
+  return found;
+}
+
+/**********************************************************************
+ * matchesBackward
+ *
+ * Description: Runs the DFA over the input from its last byte to its
+ *      first, for an NFA built from a reversed pattern. The reversed
+ *      pattern starts with '^' so only one attempt is made, from the end
+ *      of the input, and the DFA stops once it dies
+ *
+ * Parameters:
+ *   input: the string to read backwards, its start is the end anchor
+ *   budget: how many bytes may still be read, reduced by the bytes read.
+ *       The result is false once it runs out
+ *
+ * Returns: true if the reversed pattern was found
+ *********************************************************************/
+bool Nfa::matchesBackward(std::string_view input, std::size_t& budget) const
+{
+#if GREP_STATS
+  StatsTimer timer(m_dfaStats);
+#endif
+
+  std::unique_ptr<NfaCache> cache = checkoutCache();
+  int state = dfaStartState(*cache);
+  int restart = dfaRestartState(*cache);
+  bool found = cache->dfaStates[state].isMatch;
+  std::size_t pos = input.size();
+
+  for (; pos > 0 && !found && state != restart; --pos)
+  {
+    if (budget == 0)
+    {
+      returnCache(std::move(cache));
+      return false;
+    }
+
+    --budget;
+
+#if GREP_STATS
+    m_dfaStats.bytes.add();
+#endif
+
+    int byteClass = m_byteClasses[static_cast<unsigned char>(input[pos - 1])];
+    int next = cache->transitions[state * m_classRepresentatives.size() + byteClass];
+
+    if (next < 0)
+    {
+      next = dfaNextState(*cache, state, byteClass);
+      restart = dfaRestartState(*cache);
+    }
+
+    state = next;
+    found = cache->dfaStates[state].isMatch;
+  }
+
+  // the end anchors of the reversed pattern are the start of the input
+  if (!found && pos == 0)
+    found = dfaEndMatch(*cache, state);
+
+  returnCache(std::move(cache));
+
+  return found;
+}
+
+/**********************************************************************
+ * matchingPatterns
+ *
+ * Description: Finds every pattern that appears anywhere in the input,
+ *      unlike matches() the whole input is read unless every pattern
+ *      has already been found
+ *
+ * Parameters:
+ *   input: the string to search for the patterns
+ *   patterns: set to the index of each pattern found, in index order
+ *********************************************************************/
+void Nfa::matchingPatterns(std::string_view input, std::vector<std::size_t>& patterns) const
+{
+  std::unique_ptr<NfaCache> cache = checkoutCache();
+
+  if (++cache->patternGeneration == 0)
+  {
+    std::fill(cache->patternMarks.begin(), cache->patternMarks.end(), 0);
+    cache->patternGeneration = 1;
+  }
+
+  patterns.clear();
+
+  auto addMatches = [&](const std::vector<int>& matches)
+  {
+    for (int pattern : matches)
+    {
+      if (cache->patternMarks[pattern] != cache->patternGeneration)
+      {
+        cache->patternMarks[pattern] = cache->patternGeneration;
+        patterns.push_back(pattern);
+      }
+    }
+  };
+
+  // both anchors can pass when there is no input
+  if (input.empty())
+  {
+    std::vector<int> set, matches;
+    cache->nextGeneration();
+    closure(*cache, set, m_start, true, true);
+
+    for (int state : set)
+    {
+      if (m_states[state].op == NfaOp::Match)
+        matches.push_back(m_states[state].out);
+    }
+
+    std::sort(matches.begin(), matches.end());
+    addMatches(matches);
+    returnCache(std::move(cache));
+    return;
+  }
+
+#if GREP_STATS
+  StatsTimer timer(m_dfaStats);
+#endif
+
+  int state = dfaStartState(*cache);
+  int restart = dfaRestartState(*cache);
+  addMatches(cache->dfaStates[state].matches);
+  std::size_t pos = 0;
+
+  for (; pos < input.size() && patterns.size() < m_patternCount; ++pos)
+  {
+    if (state == restart && m_skipRestart && (pos = m_restartClass.find(input, pos)) == std::string_view::npos)
+      break;
+
+    int byteClass = m_byteClasses[static_cast<unsigned char>(input[pos])];
+    int next = cache->transitions[state * m_classRepresentatives.size() + byteClass];
+
+    if (next < 0)
+    {
+      next = dfaNextState(*cache, state, byteClass);
+      restart = dfaRestartState(*cache);
+    }
+
+    state = next;
+
+    if (cache->dfaStates[state].isMatch)
+      addMatches(cache->dfaStates[state].matches);
+  }
+
+  if (dfaEndMatch(*cache, state))
+    addMatches(cache->dfaStates[state].endMatches);
+
+#if GREP_STATS
+  m_dfaStats.bytes.add(std::min(pos, input.size()));
+#endif
+
+  returnCache(std::move(cache));
+  std::sort(patterns.begin(), patterns.end());
+}
+
+/**********************************************************************
+ * addPatterns
+ *
+ * Description: Adds the patterns of a DFA state to those found so far,
+ *      keeping them in index order without repeats
+ *
+ * Parameters:
+ *   patterns: the patterns found so far
+ *   matches: the patterns to add
+ *********************************************************************/
+static void addPatterns(std::vector<std::size_t>& patterns, const std::vector<int>& matches)
+{
+  for (std::size_t pattern : matches)
+  {
+    auto it = std::lower_bound(patterns.begin(), patterns.end(), pattern);
+    if (it == patterns.end() || *it != pattern)
+      patterns.insert(it, pattern);
+  }
+}
+
+/**********************************************************************
+ * scan
+ *
+ * Description: Runs the DFA over the next piece of an input too long to
+ *      hold at once, carrying on from where the previous piece left off.
+ *      Like matchingPatterns() it stops reading once every pattern has
+ *      been found
+ *
+ * Parameters:
+ *   scan: how far the search has got, updated for the piece
+ *   piece: the next bytes of the input
+ *********************************************************************/
+void Nfa::scan(Scan& scan, std::string_view piece) const
+{
+  if (piece.empty() || scan.patterns.size() == m_patternCount)
+    return;
+
+#if GREP_STATS
+  StatsTimer timer(m_dfaStats);
+#endif
+
+  std::unique_ptr<NfaCache> cache = checkoutCache();
+  int state = scan.started ? dfaState(*cache, scan.states) : dfaStartState(*cache);
+  int restart = dfaRestartState(*cache);
+  std::size_t pos = 0;
+
+  if (!scan.started)
+    addPatterns(scan.patterns, cache->dfaStates[state].matches);
+
+  scan.started = true;
+
+  for (; pos < piece.size() && scan.patterns.size() < m_patternCount; ++pos)
+  {
+    if (state == restart && m_skipRestart && (pos = m_restartClass.find(piece, pos)) == std::string_view::npos)
+      break;
+
+    int byteClass = m_byteClasses[static_cast<unsigned char>(piece[pos])];
+    int next = cache->transitions[state * m_classRepresentatives.size() + byteClass];
+
+    if (next < 0)
+    {
+      next = dfaNextState(*cache, state, byteClass);
+      restart = dfaRestartState(*cache);
+    }
+
+    state = next;
+
+    if (cache->dfaStates[state].isMatch)
+      addPatterns(scan.patterns, cache->dfaStates[state].matches);
+  }
+
+  scan.states = cache->dfaStates[state].nfaStates;
+
+#if GREP_STATS
+  m_dfaStats.bytes.add(std::min(pos, piece.size()));
+#endif
+
+  returnCache(std::move(cache));
+}
+
+/**********************************************************************
+ * finishScan
+ *
+ * Description: Ends a search handed the input a piece at a time, the
+ *      end anchors can pass now the whole input has been read
+ *
+ * Parameters:
+ *   scan: how far the search got
+ *   patterns: set to the index of each pattern found, in index order
+ *********************************************************************/
+void Nfa::finishScan(Scan& scan, std::vector<std::size_t>& patterns) const
+{
+  if (!scan.started)
+  {
+    matchingPatterns({}, patterns);
+    return;
+  }
+
+  if (scan.patterns.size() < m_patternCount)
+  {
+    std::unique_ptr<NfaCache> cache = checkoutCache();
+    int state = dfaState(*cache, scan.states);
+
+    if (dfaEndMatch(*cache, state))
+      addPatterns(scan.patterns, cache->dfaStates[state].endMatches);
+
+    returnCache(std::move(cache));
+  }
+
+  patterns = scan.patterns;
+}
+
+/**********************************************************************
+ * closure
+ *
+ * Description: Adds the state and every state reachable from it without
+ *      consuming input to the set, end anchors that can't be passed yet
+ *      are kept so they can be checked at the end of the input
+ *
+ * Parameters:
+ *   cache: scratch space holding the marks for this set
+ *   set: the NFA states making up a DFA state
+ *   state: the state to add
+ *   atStart: whether the set is for the start of the input
+ *   atEnd: whether the set is for the end of the input
+ *********************************************************************/
+void Nfa::closure(NfaCache& cache, std::vector<int>& set, int state, bool atStart, bool atEnd) const
+{
+  std::vector<int>& stack = cache.stack;
+  stack.assign(1, state);
+
+  while (!stack.empty())
+  {
+    state = stack.back();
+    stack.pop_back();
+
+    if (cache.marks[state] == cache.generation)
+      continue;
+    cache.marks[state] = cache.generation;
+
+    const NfaState& nfaState = m_states[state];
+
+    switch (nfaState.op)
+    {
+      case NfaOp::Split:
+        stack.push_back(nfaState.out1);
+        stack.push_back(nfaState.out);
+        break;
+      case NfaOp::Jump:
+      case NfaOp::Save:
+        stack.push_back(nfaState.out);
+        break;
+      case NfaOp::AssertStart:
+        if (atStart)
+          stack.push_back(nfaState.out);
+        break;
+      case NfaOp::AssertEnd:
+        if (atEnd)
+          stack.push_back(nfaState.out);
+        else
+          set.push_back(state);
+        break;
+      case NfaOp::Character:
+      case NfaOp::Match:
+        set.push_back(state);
+        break;
+    }
+  }
+}
+
+/**********************************************************************
+ * dfaState
+ *
+ * Description: Finds the DFA state for a set of NFA states, creating
+ *      it if this set hasn't been seen before
+ *
+ * Parameters:
+ *   cache: the DFA being built
+ *   set: the NFA states, sorted in place
+ *
+ * Returns: the index of the DFA state
+ *********************************************************************/
+int Nfa::dfaState(NfaCache& cache, std::vector<int>& set) const
+{
+  std::sort(set.begin(), set.end());
+  set.erase(std::unique(set.begin(), set.end()), set.end());
+
+  if (auto it = cache.dfaLookup.find(set); it != cache.dfaLookup.end())
+    return it->second;
+
+  DfaState dfaState;
+  dfaState.nfaStates = set;
+
+  for (int state : set)
+  {
+    if (m_states[state].op == NfaOp::Match)
+      dfaState.matches.push_back(m_states[state].out);
+  }
+
+  dfaState.isMatch = !dfaState.matches.empty();
+
+  cache.dfaStates.push_back(std::move(dfaState));
+  cache.transitions.resize(cache.transitions.size() + m_classRepresentatives.size(), -1);
+
+  return cache.dfaLookup[set] = cache.dfaStates.size() - 1;
+}
+
+/**********************************************************************
+ * dfaStartState
+ *
+ * Returns: the DFA state before any input has been read
+ *********************************************************************/
+int Nfa::dfaStartState(NfaCache& cache) const
+{
+  if (cache.dfaStart >= 0)
+    return cache.dfaStart;
+
+  std::vector<int> set;
+  cache.nextGeneration();
+  closure(cache, set, m_start, true, false);
+
+  return cache.dfaStart = dfaState(cache, set);
+}
+
+/**********************************************************************
+ * dfaRestartState
+ *
+ * Returns: the DFA state where nothing is partly matched, only a new
+ *      attempt at a match is running
+ *********************************************************************/
+int Nfa::dfaRestartState(NfaCache& cache) const
+{
+  if (cache.dfaRestart >= 0)
+    return cache.dfaRestart;
+
+  std::vector<int> set;
+  cache.nextGeneration();
+  closure(cache, set, m_start, false, false);
+
+  return cache.dfaRestart = dfaState(cache, set);
+}
+
+/**********************************************************************
+ * dfaNextState
+ *
+ * Description: Works out and caches the transition out of a DFA state
+ *
+ * Parameters:
+ *   cache: the DFA being built
+ *   state: the DFA state being left
+ *   byteClass: the class of the byte being read
+ *
+ * Returns: the DFA state after the byte
+ *********************************************************************/
+int Nfa::dfaNextState(NfaCache& cache, int state, int byteClass) const
+{
+  unsigned char byte = m_classRepresentatives[byteClass];
+  std::vector<int> set;
+
+#if GREP_STATS
+  m_transitionsBuilt.add();
+#endif
+
+  cache.nextGeneration();
+
+  for (int nfaState : cache.dfaStates[state].nfaStates)
+  {
+    if (m_states[nfaState].op == NfaOp::Character && m_states[nfaState].characters[byte])
+      closure(cache, set, m_states[nfaState].out, false, false);
+  }
+
+  // a new attempt starts after every byte since the search is unanchored
+  closure(cache, set, m_start, false, false);
+
+  // keep the cache bounded, only the state being left is needed again
+  if (cache.dfaStates.size() >= MAX_DFA_STATES)
+  {
+    std::vector<int> current = cache.dfaStates[state].nfaStates;
+
+#if GREP_STATS
+    m_cacheResets.add();
+#endif
+
+    cache.dfaStates.clear();
+    cache.transitions.clear();
+    cache.dfaLookup.clear();
+    cache.dfaStart = -1;
+    cache.dfaRestart = -1;
+
+    state = dfaState(cache, current);
+  }
+
+  int next = dfaState(cache, set);
+  cache.transitions[state * m_classRepresentatives.size() + byteClass] = next;
+
+  return next;
+}
+
+/**********************************************************************
+ * dfaEndMatch
+ *
+ * Description: Checks if a DFA state matches once the end of the input
+ *      has been reached, letting any end anchors through
+ *
+ * Returns: true if the pattern matched
+ *********************************************************************/
+bool Nfa::dfaEndMatch(NfaCache& cache, int state) const
+{
+  DfaState& dfaState = cache.dfaStates[state];
+
+  if (dfaState.endMatch >= 0)
+    return dfaState.endMatch;
+
+  std::vector<int> set;
+  cache.nextGeneration();
+
+  for (int nfaState : dfaState.nfaStates)
+  {
+    if (m_states[nfaState].op == NfaOp::AssertEnd)
+      closure(cache, set, m_states[nfaState].out, false, true);
+  }
+
+  dfaState.endMatches = dfaState.matches;
+
+  for (int nfaState : set)
+  {
+    if (m_states[nfaState].op == NfaOp::Match)
+      dfaState.endMatches.push_back(m_states[nfaState].out);
+  }
+
+  dfaState.endMatch = !dfaState.endMatches.empty();
+
+  return dfaState.endMatch;
+}
+
+/**********************************************************************
+ * checkoutCache / returnCache
+ *
+ * Description: Hands out scratch space so concurrent calls never share
+ *      it, caches are reused so the DFA stays warm between calls. The
+ *      calling thread's own cache is tried before the shared pool
+ *********************************************************************/
+std::unique_ptr<NfaCache> Nfa::checkoutCache() const
+{
+  // a thread searching with the same NFA line after line never takes the lock
+  ThreadCache& threadCache = t_cache;
+  if (threadCache.owner == m_id && threadCache.cache)
+    return std::move(threadCache.cache);
+
+  {
+    std::lock_guard<std::mutex> lock(m_cacheLock);
+
+    if (!m_caches.empty())
+    {
+      std::unique_ptr<NfaCache> cache = std::move(m_caches.back());
+      m_caches.pop_back();
+      return cache;
+    }
+  }
+
+  std::unique_ptr<NfaCache> cache = std::make_unique<NfaCache>();
+  cache->marks.assign(m_states.size(), 0);
+  cache->pendingExits.assign(m_states.size(), 0);
+  cache->patternMarks.assign(m_patternCount, 0);
+
+  return cache;
+}
+
+void Nfa::returnCache(std::unique_ptr<NfaCache> cache) const
+{
+  // the thread's slot is only taken from another NFA once that NFA is gone, so
+  // threads switching between live NFAs don't keep throwing their DFAs away
+  ThreadCache& threadCache = t_cache;
+  if (threadCache.owner == m_id)
+  {
+    threadCache.cache = std::move(cache);
+    return;
+  }
+
+  if (!threadCache.cache || threadCache.ownerAlive.expired())
+  {
+    threadCache.owner = m_id;
+    threadCache.ownerAlive = m_alive;
+    threadCache.cache = std::move(cache);
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(m_cacheLock);
+
+  m_caches.push_back(std::move(cache));
+}
+
+#if GREP_STATS
+/**********************************************************************
+ * writeStats
+ *
+ * Description: Writes the counts of the DFA and pike VM, along with how
+ *      many DFA transitions had to be worked out and how often the DFA
+ *      cache filled up and was thrown away
+ *
+ * Parameters:
+ *   json: where to write the counts
+ *********************************************************************/
+void Nfa::writeStats(JsonWriter& json) const
+{
+  json.field("states", static_cast<std::uint64_t>(m_states.size()));
+  json.engine("dfa", m_dfaStats);
+  json.engine("pike_vm", m_pikeStats);
+  json.field("dfa_transitions_built", m_transitionsBuilt.value());
+  json.field("dfa_cache_resets", m_cacheResets.value());
+}
+#endif
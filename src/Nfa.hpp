@@ -0,0 +1,140 @@
+#pragma once
+
+#include "CharacterClass.hpp"
+#include "Stats.hpp"
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+enum class NfaOp : std::uint8_t
+{
+  Character,   // consume one byte that is in characters then go to out
+  Split,       // try out first then out1
+  Jump,        // go to out without consuming anything
+  AssertStart, // only continue to out at the start of the input
+  AssertEnd,   // only continue to out at the end of the input
+  Match,       // the whole pattern has been matched, out is which pattern
+  Save         // record the position in capture slot out1 then go to out
+};
+
+struct NfaState
+{
+  NfaOp op = NfaOp::Jump;
+  int out = -1;
+  int out1 = -1;
+  CharacterSet characters;
+};
+
+struct NfaCache;
+class CacheReader;
+class CacheWriter;
+
+class Nfa
+{
+  public:
+    // a partially built piece of the NFA, holes are the exits still to be connected
+    struct Fragment
+    {
+      int start = -1;
+      std::vector<int> holes;
+    };
+
+    // how far a search handed the input a piece at a time has got, the DFA
+    // state is kept as its NFA states since the cache can be reset between pieces
+    struct Scan
+    {
+      std::vector<int> states;
+      std::vector<std::size_t> patterns; // found so far, in index order
+      bool started = false;
+    };
+
+    Nfa();
+    Nfa(CacheReader& reader);
+    Nfa(const Nfa& patternSet, std::size_t pattern);
+    ~Nfa();
+
+    void save(CacheWriter& writer) const;
+
+    Fragment character(const CharacterSet& characters);
+    Fragment assertStart();
+    Fragment assertEnd();
+    Fragment empty();
+    Fragment save(int slot);
+
+    Fragment concatenate(const Fragment& first, const Fragment& second);
+    Fragment alternate(const Fragment& first, const Fragment& second);
+    Fragment oneOrMore(const Fragment& fragment, bool lazy = false);
+    Fragment optional(const Fragment& fragment, bool lazy = false);
+
+    void finish(const Fragment& fragment);
+    void finish(const std::vector<Fragment>& fragments);
+
+    std::size_t find(std::string_view input, bool startsWith = false) const;
+    std::size_t find(std::string_view input, std::size_t from, std::vector<std::size_t>& captures) const;
+    bool matches(std::string_view input) const;
+    bool matchesBackward(std::string_view input, std::size_t& budget) const;
+    void matchingPatterns(std::string_view input, std::vector<std::size_t>& patterns) const;
+    void scan(Scan& scan, std::string_view piece) const;
+    void finishScan(Scan& scan, std::vector<std::size_t>& patterns) const;
+
+    std::size_t patternCount() const { return m_patternCount; };
+
+#if GREP_STATS
+    void writeStats(JsonWriter& json) const;
+#endif
+
+  private:
+    int addState(NfaOp op, int out = -1, int out1 = -1);
+    void patch(const std::vector<int>& holes, int target);
+    void computeByteClasses();
+    void computeSearchTables();
+
+    void addThread(NfaCache& cache, std::vector<int>& list, int state, std::size_t pos, std::size_t size) const;
+    void addCaptureThread(NfaCache& cache, std::vector<int>& list, std::vector<std::size_t>& captures, int state, std::size_t pos, std::size_t size) const;
+    void closure(NfaCache& cache, std::vector<int>& set, int state, bool atStart, bool atEnd) const;
+
+    int dfaState(NfaCache& cache, std::vector<int>& set) const;
+    int dfaStartState(NfaCache& cache) const;
+    int dfaRestartState(NfaCache& cache) const;
+    int dfaNextState(NfaCache& cache, int state, int byteClass) const;
+    bool dfaEndMatch(NfaCache& cache, int state) const;
+
+    std::unique_ptr<NfaCache> checkoutCache() const;
+    void returnCache(std::unique_ptr<NfaCache> cache) const;
+
+    std::vector<NfaState> m_states;
+    int m_start = -1;
+    std::size_t m_patternCount = 0;
+    std::vector<int> m_patternStarts; // where each pattern's own fragment starts
+
+    // bytes that no pattern can tell apart share a byte class to keep the DFA small
+    std::array<std::uint8_t, 256> m_byteClasses = {};
+    std::vector<std::uint8_t> m_classRepresentatives;
+
+    // bytes that can start a match, used to skip ahead while nothing is partly matched
+    CharacterClass m_restartClass;
+    bool m_skipRestart = false;
+    bool m_anchored = false; // nothing can start a match after position 0
+
+    // scratch space is pooled so find/matches can be called from many threads,
+    // each thread also keeps one cache of its own that it can use without the lock
+    mutable std::mutex m_cacheLock;
+    mutable std::vector<std::unique_ptr<NfaCache>> m_caches;
+
+    // identifies this NFA to the per thread caches, they only hold a weak reference
+    // to m_alive so a cache left behind by a destroyed NFA can be taken over
+    std::uint64_t m_id;
+    std::shared_ptr<const bool> m_alive;
+
+#if GREP_STATS
+    // what --stats reports, the DFA counts cover reading backwards too
+    mutable EngineStats m_dfaStats;
+    mutable EngineStats m_pikeStats;
+    mutable StatsCounter m_transitionsBuilt;
+    mutable StatsCounter m_cacheResets;
+#endif
+};
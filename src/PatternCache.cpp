@@ -0,0 +1,294 @@
+#include "PatternCache.hpp"
+#include "MappedFile.hpp"
+#include "Patterns.hpp"
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+
+#include <unistd.h>
+
+// bump whenever anything written by a save() changes
+constexpr std::uint32_t CACHE_VERSION = 6;
+
+constexpr std::array<char, 8> CACHE_MAGIC = {'G', 'R', 'E', 'P', 'C', 'A', 'C', 'H'};
+
+// caches are only read back on a machine with the same byte order
+constexpr std::uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+/**********************************************************************
+ * CacheWriter writeString
+ *
+ * Parameters:
+ *   value: the bytes to write, preceded by their length
+ *********************************************************************/
+void CacheWriter::writeString(std::string_view value)
+{
+  write<std::uint64_t>(value.size());
+  m_data.append(value);
+}
+
+/**********************************************************************
+ * CacheWriter writeCharacterSet
+ *
+ * Parameters:
+ *   characters: the set to write as four words, lowest byte values first
+ *********************************************************************/
+void CacheWriter::writeCharacterSet(const CharacterSet& characters)
+{
+  // whole words at a time, NFAs for big pattern sets have a set per state
+  const CharacterSet word(~0ull);
+
+  for (int shift = 0; shift < 256; shift += 64)
+    write<std::uint64_t>(((characters >> shift) & word).to_ullong());
+}
+
+/**********************************************************************
+ * CacheReader take
+ *
+ * Parameters:
+ *   size: how many bytes to consume
+ *
+ * Returns: the start of the consumed bytes
+ *********************************************************************/
+const char* CacheReader::take(std::size_t size)
+{
+  if (size > remaining())
+    throw std::runtime_error("Pattern cache is truncated");
+
+  const char* data = m_data.data() + m_pos;
+  m_pos += size;
+
+  return data;
+}
+
+/**********************************************************************
+ * CacheReader readCount
+ *
+ * Description: Reads how many elements follow, a count the rest of
+ *      the file can't hold means the cache is damaged and must not be
+ *      used to size anything
+ *
+ * Parameters:
+ *   elementSize: the fewest bytes each element takes up in the cache
+ *
+ * Returns: the number of elements
+ *********************************************************************/
+std::size_t CacheReader::readCount(std::size_t elementSize)
+{
+  std::uint64_t count = read<std::uint64_t>();
+
+  if (count > remaining() / elementSize)
+    throw std::runtime_error("Pattern cache is truncated");
+
+  return count;
+}
+
+std::string CacheReader::readString()
+{
+  std::size_t size = readCount(1);
+
+  return std::string(take(size), size);
+}
+
+CharacterSet CacheReader::readCharacterSet()
+{
+  std::array<std::uint64_t, 4> words = read<std::array<std::uint64_t, 4>>();
+  CharacterSet characters;
+
+  for (int word = 3; word >= 0; --word)
+    characters = (characters << 64) | CharacterSet(words[word]);
+
+  return characters;
+}
+
+/**********************************************************************
+ * hashPatterns
+ *
+ * Description: FNV-1a hash of everything that decides what gets
+ *      compiled, used to name the cache file
+ *
+ * Parameters:
+ *   patterns: the pattern text
+ *   patternSet: whether the patterns are compiled as a set
+ *
+ * Returns: the hash
+ *********************************************************************/
+static std::uint64_t hashPatterns(const std::vector<std::string>& patterns, bool patternSet)
+{
+  std::uint64_t hash = 14695981039346656037ull;
+
+  auto add = [&hash](const void* data, std::size_t size)
+  {
+    for (std::size_t i = 0; i < size; ++i)
+    {
+      hash ^= static_cast<const unsigned char*>(data)[i];
+      hash *= 1099511628211ull;
+    }
+  };
+
+  add(&CACHE_VERSION, sizeof(CACHE_VERSION));
+  add(&patternSet, sizeof(patternSet));
+
+  for (const std::string& pattern : patterns)
+  {
+    std::uint64_t size = pattern.size();
+    add(&size, sizeof(size));
+    add(pattern.data(), pattern.size());
+  }
+
+  return hash;
+}
+
+/**********************************************************************
+ * writeHeader
+ *
+ * Description: Writes what a cache file must start with, the pattern
+ *      text is kept so a hash collision can't load the wrong program
+ *
+ * Parameters:
+ *   writer: where to write the header
+ *   patterns: the pattern text
+ *   patternSet: whether the patterns are compiled as a set
+ *********************************************************************/
+static void writeHeader(CacheWriter& writer, const std::vector<std::string>& patterns, bool patternSet)
+{
+  writer.write(CACHE_MAGIC);
+  writer.write(CACHE_VERSION);
+  writer.write(BYTE_ORDER_MARK);
+  writer.write<std::uint8_t>(patternSet);
+  writer.write<std::uint64_t>(patterns.size());
+
+  for (const std::string& pattern : patterns)
+    writer.writeString(pattern);
+}
+
+/**********************************************************************
+ * loadPattern
+ *
+ * Description: Maps a cache file and rebuilds the compiled pattern from
+ *      it without parsing anything
+ *
+ * Parameters:
+ *   path: the cache file
+ *   patterns: the pattern text the cache must have been built from
+ *   patternSet: whether the patterns are compiled as a set
+ *
+ * Returns: the compiled pattern, null if the file is missing, from
+ *      another version or for other patterns
+ *********************************************************************/
+static std::unique_ptr<CompiledPattern> loadPattern(const std::string& path, const std::vector<std::string>& patterns, bool patternSet)
+{
+  if (!std::filesystem::is_regular_file(path))
+    return nullptr;
+
+  try
+  {
+    MappedFile file(path);
+    if (!file.is_mapped())
+      return nullptr;
+
+    CacheReader reader(file.data());
+
+    if (reader.read<std::array<char, 8>>() != CACHE_MAGIC ||
+        reader.read<std::uint32_t>() != CACHE_VERSION ||
+        reader.read<std::uint32_t>() != BYTE_ORDER_MARK ||
+        reader.read<std::uint8_t>() != patternSet ||
+        reader.read<std::uint64_t>() != patterns.size())
+      return nullptr;
+
+    for (const std::string& pattern : patterns)
+    {
+      if (reader.readString() != pattern)
+        return nullptr;
+    }
+
+    std::unique_ptr<CompiledPattern> compiled = std::make_unique<CompiledPattern>(reader);
+
+    if (reader.remaining() != 0)
+      return nullptr;
+
+    return compiled;
+  }
+  catch (const std::exception& e)
+  {
+    // a damaged cache is rebuilt like a missing one, even if a count in it made an allocation fail
+    return nullptr;
+  }
+}
+
+/**********************************************************************
+ * savePattern
+ *
+ * Description: Writes the compiled pattern to a temporary file then
+ *      renames it into place so other processes never map half a file.
+ *      The cache is only an optimization so failures are ignored
+ *
+ * Parameters:
+ *   directory: the cache directory, created if needed
+ *   path: the cache file
+ *   patterns: the pattern text
+ *   patternSet: whether the patterns are compiled as a set
+ *   compiled: the compiled pattern to save
+ *********************************************************************/
+static void savePattern(const std::string& directory, const std::string& path, const std::vector<std::string>& patterns, bool patternSet, const CompiledPattern& compiled)
+{
+  CacheWriter writer;
+  writeHeader(writer, patterns, patternSet);
+  compiled.save(writer);
+
+  std::error_code error;
+  std::filesystem::create_directories(directory, error);
+
+  std::string temporary = path + "." + std::to_string(::getpid()) + ".tmp";
+
+  {
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    file.write(writer.data().data(), writer.data().size());
+
+    if (!file)
+    {
+      std::filesystem::remove(temporary, error);
+      return;
+    }
+  }
+
+  std::filesystem::rename(temporary, path, error);
+  if (error)
+    std::filesystem::remove(temporary, error);
+}
+
+/**********************************************************************
+ * compileCached
+ *
+ * Description: Loads the compiled patterns from the cache directory,
+ *      compiling and caching them if they aren't there yet. Patterns
+ *      that need the backtracker keep their pattern list so they are
+ *      always compiled
+ *
+ * Parameters:
+ *   directory: where the cache files are kept
+ *   patterns: the pattern, or every pattern of a pattern set
+ *   patternSet: whether the patterns are compiled as a set
+ *
+ * Returns: the compiled patterns
+ *********************************************************************/
+std::unique_ptr<CompiledPattern> compileCached(const std::string& directory, const std::vector<std::string>& patterns, bool patternSet)
+{
+  char name[32];
+  std::snprintf(name, sizeof(name), "%016llx.gpc", static_cast<unsigned long long>(hashPatterns(patterns, patternSet)));
+  std::string path = directory + "/" + name;
+
+  if (std::unique_ptr<CompiledPattern> cached = loadPattern(path, patterns, patternSet))
+    return cached;
+
+  std::unique_ptr<CompiledPattern> compiled = patternSet ? std::make_unique<CompiledPattern>(patterns)
+                                                         : std::make_unique<CompiledPattern>(patterns.at(0));
+
+  if (compiled->cacheable())
+    savePattern(directory, path, patterns, patternSet, *compiled);
+
+  return compiled;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "CharacterClass.hpp"
+
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+class CompiledPattern;
+
+// appends values to a compiled pattern cache file in the host's byte order
+class CacheWriter
+{
+  public:
+    CacheWriter() = default;
+    ~CacheWriter() = default;
+
+    template <typename T>
+    void write(const T& value)
+    {
+      static_assert(std::is_trivially_copyable_v<T>);
+      m_data.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    void writeVector(const std::vector<T>& values)
+    {
+      static_assert(std::is_trivially_copyable_v<T>);
+      write<std::uint64_t>(values.size());
+      m_data.append(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+    }
+
+    void writeString(std::string_view value);
+    void writeCharacterSet(const CharacterSet& characters);
+
+    const std::string& data() const { return m_data; };
+
+  private:
+    std::string m_data;
+};
+
+// reads values back out of a mapped cache file, running off the end throws
+class CacheReader
+{
+  public:
+    CacheReader(std::string_view data) : m_data(data) {};
+    ~CacheReader() = default;
+
+    template <typename T>
+    T read()
+    {
+      static_assert(std::is_trivially_copyable_v<T>);
+      T value;
+      std::memcpy(&value, take(sizeof(T)), sizeof(T));
+      return value;
+    }
+
+    template <typename T>
+    std::vector<T> readVector()
+    {
+      static_assert(std::is_trivially_copyable_v<T>);
+      std::size_t size = readCount(sizeof(T));
+      std::vector<T> values(size);
+      std::memcpy(values.data(), take(size * sizeof(T)), size * sizeof(T));
+      return values;
+    }
+
+    std::size_t readCount(std::size_t elementSize);
+    std::string readString();
+    CharacterSet readCharacterSet();
+
+    std::size_t remaining() const { return m_data.size() - m_pos; };
+
+  private:
+    const char* take(std::size_t size);
+
+    std::string_view m_data;
+    std::size_t m_pos = 0;
+};
+
+std::unique_ptr<CompiledPattern> compileCached(const std::string& directory, const std::vector<std::string>& patterns, bool patternSet);
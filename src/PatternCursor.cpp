@@ -0,0 +1,40 @@
+#include "PatternCursor.hpp"
+
+/**********************************************************************
+ * take
+ *
+ * Description: Splits off the next characters as their own cursor, used
+ *      to hand part of the patterns to a sub pattern
+ *
+ * Parameters:
+ *   count: the number of characters to take
+ *
+ * Returns: a cursor over just those characters which keeps their
+ *      columns in the original patterns
+ *********************************************************************/
+PatternCursor PatternCursor::take(std::size_t count)
+{
+  count = std::min(count, size());
+
+  PatternCursor taken(m_patterns.substr(m_pos, count), column());
+  m_pos += count;
+
+  return taken;
+}
+
+/**********************************************************************
+ * error
+ *
+ * Description: Builds a parse error pointing at the current position
+ *
+ * Parameters:
+ *   message: what went wrong
+ *   offset: how far past the current position the problem is
+ *
+ * Returns: the error to throw, the column is counted from 1 like
+ *      compiler errors
+ *********************************************************************/
+std::runtime_error PatternCursor::error(const std::string& message, std::size_t offset) const
+{
+  return std::runtime_error(message + " at column " + std::to_string(column() + offset + 1));
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// a read position in a pattern string, parsing moves the position forward
+// instead of copying what is left so it stays linear and columns are known
+class PatternCursor
+{
+  public:
+    PatternCursor(std::string_view patterns, std::size_t column = 0)
+    : m_patterns(patterns), m_column(column) {};
+
+    bool empty() const { return m_pos >= m_patterns.size(); };
+    std::size_t size() const { return m_patterns.size() - m_pos; };
+
+    // column in the original pattern string, counting from 0
+    std::size_t column() const { return m_column + m_pos; };
+
+    char peek(std::size_t ahead = 0) const { return ahead < size() ? m_patterns[m_pos + ahead] : '\0'; };
+    bool startsWith(std::string_view token) const { return rest().starts_with(token); };
+    std::string_view rest() const { return m_patterns.substr(m_pos); };
+
+    void advance(std::size_t count = 1) { m_pos = std::min(m_pos + count, m_patterns.size()); };
+    PatternCursor take(std::size_t count);
+
+    std::runtime_error error(const std::string& message, std::size_t offset = 0) const;
+
+  private:
+    std::string_view m_patterns;
+    std::size_t m_pos = 0;
+    std::size_t m_column = 0;
+};
@@ -1,227 +1,1495 @@
 #include "Patterns.hpp"
+#include "PatternCache.hpp"
 
 #define DEBUGGING 0
 
 #include <algorithm>
+#include <cctype>
 #include <iostream>
+#include <map>
+#include <numeric>
+
+// largest count allowed in {m,n}, the NFA gets a copy of the pattern per repeat.
+// A repeated group's copies hold copies of the repeats inside it so what the
+// whole group unrolls to is held to the same limit, like RE2
+constexpr std::uint32_t REPEAT_LIMIT = 1000;
+
+// a pattern set's candidates for a line are matched on their own when they
+// are at most this fraction of the set, otherwise the whole set is run, so
+// smaller sets aren't indexed unless they need the backtracker
+constexpr std::size_t CANDIDATE_FRACTION = 16;
 
 
 /**********************************************************************
  * findMatchingEndBracket
  *
- * Description: Finds the end (closing ')') bracket position of the
- *      given bracket in the string
+ * Description: Finds the end (closing ')') bracket of the current group
+ *      in one pass, nested groups are stepped over and brackets inside
+ *      a character group are just characters
  *
  * Parameters:
- *   pos: the position of the opening bracket (assumes open bracket)
+ *   pos: the position just after the opening bracket
  *   input: the string with both brackets
  *
  * Returns: the position of closing bracket corresponding to the given
  *      open bracket, npos if not found
  *********************************************************************/
-std::size_t findMatchingEndBracket(std::size_t pos, const std::string& input)
+std::size_t findMatchingEndBracket(std::size_t pos, std::string_view input)
 {
-  int tries = 100;
-  std::size_t newBracketPos = pos;
+  int depth = 1;
 
 #if DEBUGGING
-  std::cout << "searching end bracket for one at pos " << pos << " in " + input << std::endl;
+  std::cout << "searching end bracket from pos " << pos << " in " << input << std::endl;
 #endif
 
-  while (pos < std::string::npos && tries > 0)
+  for (; pos < input.size(); ++pos)
   {
-    pos = input.find_first_of(")", pos+1); // check for end bracket
-    newBracketPos = input.find_first_of("(", newBracketPos+1); // check for a different starting bracket
-
-#if DEBUGGING
-    std::cout << "found end bracket at " << pos << " begin bracket at " << newBracketPos << " result " << (newBracketPos > pos) << std::endl;
-#endif
-    --tries;
-
-    if (newBracketPos > pos) // if there is a different
+    if (input[pos] == '[')
+    {
+      pos = input.find(']', pos + 1);
+      if (pos == std::string_view::npos)
+        break;
+    }
+    else if (input[pos] == '(')
+    {
+      ++depth;
+    }
+    else if (input[pos] == ')' && --depth == 0)
+    {
       return pos;
+    }
   }
 
-  return pos;
+  return std::string::npos;
 }
 
 /**********************************************************************
  * findAlternateMarker
  *
  * Description: Finds the alternative marker '|' withing the current
- *      bracket scope
+ *      bracket scope, markers in nested groups are skipped
  *
  * Parameters:
- *   pos: the position of the opening bracket (assumes open bracket)
+ *   pos: the position just after the opening bracket
  *   input: the string with both brackets and possible marker
  *
  * Returns: the position of alternative marker in scope of the given
  *      open bracket, npos if not found
  *********************************************************************/
-std::size_t findAlternateMarker(std::size_t pos, const std::string& input)
+std::size_t findAlternateMarker(std::size_t pos, std::string_view input)
 {
-  int tries = 100;
-  std::size_t newBracketPos = pos;
+  int depth = 1;
 
 #if DEBUGGING
-  std::cout << "searching for alternative marker from pos " << pos << " in " + input << std::endl;
+  std::cout << "searching for alternative marker from pos " << pos << " in " << input << std::endl;
 #endif
 
-  while (pos < std::string::npos && tries > 0)
+  for (; pos < input.size(); ++pos)
   {
-    pos = input.find_first_of("|", pos+1); // check for alternative marker
-    newBracketPos = input.find_first_of("(", newBracketPos+1); // check for a different starting bracket
-    std::size_t newEndBracketPos = findMatchingEndBracket(newBracketPos, input); // and its corresponding end bracket
-
-    // if there are no brackets before the alternative marker this is the correct marker
-    if (pos < newBracketPos)
+    if (input[pos] == '[')
+    {
+      pos = input.find(']', pos + 1);
+      if (pos == std::string_view::npos)
+        break;
+    }
+    else if (input[pos] == '(')
+    {
+      ++depth;
+    }
+    else if (input[pos] == ')' && --depth == 0)
+    {
+      break;
+    }
+    else if (input[pos] == '|' && depth == 1)
+    {
       return pos;
+    }
+  }
 
-    // check if its beyond the nested brackets
-    if(pos > newEndBracketPos)
-      return pos;
+  return std::string::npos;
+}
+
+/**********************************************************************
+ * parseCharacterGroup
+ *
+ * Description: Turns the inside of a character group into the set of
+ *      bytes it contains, a '-' between two characters is a range and
+ *      is a literal '-' anywhere else
+ *
+ * Parameters:
+ *   group: the characters between the brackets
+ *
+ * Returns: the set of bytes in the group
+ *********************************************************************/
+CharacterSet parseCharacterGroup(const PatternCursor& group)
+{
+  std::string_view characters = group.rest();
+  CharacterSet result;
+
+  for (std::size_t i = 0; i < characters.size(); ++i)
+  {
+    unsigned char first = characters[i];
+
+    if (i + 2 < characters.size() && characters[i+1] == '-')
+    {
+      unsigned char last = characters[i+2];
+
+      if (last < first)
+        throw group.error("Invalid range in character group " + std::string(characters.substr(i, 3)), i);
+
+      for (int c = first; c <= last; ++c)
+        result.set(c);
 
-    // the alternative marker is in a nested bracket so keep looking
-    --tries;
+      i += 2;
+    }
+    else
+    {
+      result.set(first);
+    }
   }
 
-  return std::string::npos;
+  return result;
 }
 
 /**********************************************************************
- * PatternHandler
+ * CompiledPattern
  *
- * Description: Grabs all of the patterns then calls a recursive parser
+ * Description: Grabs all of the patterns once so they can be matched
+ *      against any number of inputs with match()
  *
  * Parameters:
- *   input: the string to search for the patterns
  *   patterns: the string with all of the patterns
- *   startsWith: Whether or not the input must start with the pattern
+ *********************************************************************/
+CompiledPattern::CompiledPattern(const std::string& patterns)
+: CompiledPattern(PatternCursor(patterns))
+{
+}
+
+/**********************************************************************
+ * CompiledPattern
  *
- * Returns: the position after all of the patterns have been matched
- *      npos if no match
+ * Description: Grabs the patterns under the cursor, used for patterns
+ *      inside another so errors report columns in the whole pattern
+ *
+ * Parameters:
+ *   patterns: the cursor over the patterns
  *********************************************************************/
-PatternHandler::PatternHandler(const std::string& input, const std::string& patterns, bool startsWith)
-: m_patternList(), m_patternReferences(), m_referenceStarts(), m_referenceIndexs()
+CompiledPattern::CompiledPattern(const PatternCursor& patterns)
+: m_patternList(), m_referenceIndexs()
+{
+  addPatterns(patterns);
+  build();
+}
+
+/**********************************************************************
+ * CompiledPattern
+ *
+ * Description: Grabs a set of patterns that are searched for together,
+ *      each one becomes a branch of one alternation so a single
+ *      automaton can report which of them are in the input
+ *
+ * Parameters:
+ *   patternSet: the patterns, matchingPatterns() reports them by index
+ *********************************************************************/
+CompiledPattern::CompiledPattern(const std::vector<std::string>& patternSet)
+: m_patternList(), m_referenceIndexs(), m_patternSet(true)
 {
-  std::string workingPatterns = patterns;
+  if (patternSet.empty())
+    throw std::runtime_error("No patterns to search for");
 
-  while (workingPatterns.size() > 0)
+  AlternationPattern* alternation = new AlternationPattern(1);
+  m_patternList.emplace_back(alternation);
+
+  for (std::size_t k = 0; k < patternSet.size(); ++k)
   {
-    addPatternFromPatternString(workingPatterns);
+    if (k > 0)
+    {
+      m_patternList.emplace_back(new AlternateMarkerPattern());
+      alternation->add_branch(m_patternList.size());
+    }
+
+    m_firstReference = m_referenceCount;
+
+    try
+    {
+      addPatterns(PatternCursor(patternSet[k]));
+    }
+    catch (const std::runtime_error& e)
+    {
+      throw std::runtime_error("Pattern " + std::to_string(k + 1) + ": " + e.what());
+    }
   }
 
-  m_result = findPatterns(input, 0, 0, startsWith);
+  finishAlternation(0, m_patternList.size());
+  build();
 }
 
 /**********************************************************************
- * findPatterns
+ * CompiledPattern
  *
- * Description: Recursive function that parses all patterns within the
- *      input
+ * Description: Loads patterns saved by save(), only the automata and
+ *      prefilter are kept so the pattern list stays empty and nothing
+ *      is parsed
  *
  * Parameters:
- *    input: the string to search for the patterns
- *    pos: the position to start looking for patterns
- *    pattern: the index of the pattern currently being checked
- *    patternList: reference to vector of all patterns
- *    startsWith: Whether or not the input must start with the pattern
+ *   reader: the cache positioned at the compiled patterns
+ *********************************************************************/
+CompiledPattern::CompiledPattern(CacheReader& reader)
+: m_patternList(), m_referenceIndexs()
+{
+  m_loadedFromCache = true;
+  m_patternSet = reader.read<std::uint8_t>();
+  m_nfa = std::make_unique<Nfa>(reader);
+
+  if (std::string literal = reader.readString(); !literal.empty())
+    m_prefilter = std::make_unique<LiteralPrefilter>(literal);
+
+  if (reader.read<std::uint8_t>())
+    m_keywords = std::make_unique<AhoCorasick>(reader);
+
+  m_startAnchored = reader.read<std::uint8_t>();
+  m_anchoredPrefix = reader.readString();
+  m_anchoredSuffix = reader.readString();
+
+  if (reader.read<std::uint8_t>())
+  {
+    m_suffix = std::make_unique<LiteralPrefilter>(reader.readString());
+    m_suffixAtEnd = reader.read<std::uint8_t>();
+    m_reverseNfa = std::make_unique<Nfa>(reader);
+
+    if (m_suffix->literal().empty())
+      throw std::runtime_error("Pattern cache is corrupt");
+  }
+
+  if (reader.read<std::uint8_t>())
+  {
+    m_setLiterals = std::make_unique<AhoCorasick>(reader);
+    m_literalStarts = reader.readVector<std::uint32_t>();
+    m_literalPatterns = reader.readVector<std::uint32_t>();
+    m_unindexedPatterns = reader.readVector<std::uint32_t>();
+
+    auto validPattern = [this](std::uint32_t pattern) { return pattern < m_nfa->patternCount(); };
+
+    if (m_literalStarts.size() != m_setLiterals->keywords().size() + 1 || m_literalStarts.front() != 0 ||
+        m_literalStarts.back() != m_literalPatterns.size() || !std::is_sorted(m_literalStarts.begin(), m_literalStarts.end()) ||
+        !std::all_of(m_literalPatterns.begin(), m_literalPatterns.end(), validPattern) ||
+        !std::all_of(m_unindexedPatterns.begin(), m_unindexedPatterns.end(), validPattern))
+      throw std::runtime_error("Pattern cache is corrupt");
+
+    m_patternNfas.resize(m_nfa->patternCount());
+    m_patternNfasSplit = std::make_unique<std::once_flag[]>(m_nfa->patternCount());
+  }
+}
+
+/**********************************************************************
+ * save
  *
- * Returns: the position after this and the rest of the patterns have
- *      been matched, npos if no match
+ * Description: Writes the automata and prefilter, only patterns that
+ *      are cacheable() can be saved since the backtracker needs the
+ *      pattern list
+ *
+ * Parameters:
+ *   writer: where to write the compiled patterns
  *********************************************************************/
-std::size_t PatternHandler::findPatterns(const std::string& input, std::size_t pos, int pattern, bool startsWith)
+void CompiledPattern::save(CacheWriter& writer) const
 {
-  std::size_t newPos = 0, initialPos = pos;
+  if (!cacheable())
+    throw std::runtime_error("Patterns needing backtracking can't be cached");
 
-  if (pattern >= m_patternList.size())
+  writer.write<std::uint8_t>(m_patternSet);
+  m_nfa->save(writer);
+  writer.writeString(m_prefilter ? m_prefilter->literal() : std::string());
+  writer.write<std::uint8_t>(m_keywords != nullptr);
+
+  if (m_keywords)
+    m_keywords->save(writer);
+
+  writer.write<std::uint8_t>(m_startAnchored);
+  writer.writeString(m_anchoredPrefix);
+  writer.writeString(m_anchoredSuffix);
+  writer.write<std::uint8_t>(m_reverseNfa != nullptr);
+
+  if (m_reverseNfa)
   {
-#if DEBUGGING
-    std::cout << "3 pattern " << pattern << " succeded\n";
-#endif
-    return pos; // success
+    writer.writeString(m_suffix->literal());
+    writer.write<std::uint8_t>(m_suffixAtEnd);
+    m_reverseNfa->save(writer);
   }
 
-#if DEBUGGING
-  std::cout << "2 pos " << pos << " pattern " << pattern << " " + m_patternList[pattern]->print() << std::endl;
-#endif
+  writer.write<std::uint8_t>(m_setLiterals != nullptr);
 
-  if (pos > input.size()) // position our of bounds
+  if (m_setLiterals)
   {
-#if DEBUGGING
-    std::cout << "4 pattern " << m_patternList[pattern]->print() << " failed out of bounds\n";
-#endif
-    return std::string::npos;
+    m_setLiterals->save(writer);
+    writer.writeVector(m_literalStarts);
+    writer.writeVector(m_literalPatterns);
+    writer.writeVector(m_unindexedPatterns);
   }
+}
 
-  std::size_t preCheckPos = pos;
-  if (startsWith)
-    pos = m_patternList[pattern]->starts_with(pos, input);
-  else
-    pos = m_patternList[pattern]->find_first_of(pos, input);
+/**********************************************************************
+ * addPatterns
+ *
+ * Description: Parses one pattern onto the end of the pattern list
+ *
+ * Parameters:
+ *   patterns: the cursor over the pattern
+ *********************************************************************/
+void CompiledPattern::addPatterns(const PatternCursor& patterns)
+{
+  PatternCursor workingPatterns = patterns;
+  std::size_t topAlternation = m_patternList.size();
 
-#if DEBUGGING
-  std::cout << "5 pos " << pos << " pattern " << pattern << " " + m_patternList[pattern]->print() << std::endl;
-#endif
+  // a '|' outside of any group makes the whole pattern an alternation
+  bool alternation = findAlternateMarker(0, patterns.rest()) != std::string::npos;
+  if (alternation)
+  {
+    m_topAlternation = topAlternation;
+    m_patternList.emplace_back(new AlternationPattern(topAlternation + 1));
+  }
+
+  while (!workingPatterns.empty())
+  {
+    addPatternFromPatternString(workingPatterns);
+  }
+
+  if (m_referenceIndexs.size() > 0)
+    throw workingPatterns.error("Reference pattern missing end bracket ')'");
+
+  if (alternation)
+    finishAlternation(topAlternation, m_patternList.size());
+}
+
+/**********************************************************************
+ * build
+ *
+ * Description: Builds the automata and prefilters once the pattern
+ *      list is complete
+ *********************************************************************/
+void CompiledPattern::build()
+{
+  // the program is always built since only it can report where a match
+  // starts and what its groups captured, one instruction per pattern so
+  // every index in the list carries over
+  for (const std::unique_ptr<Pattern>& pattern : m_patternList)
+  {
+    Instruction instruction = pattern->to_instruction(m_program);
+
+    instruction.min = pattern->min_repeat;
+    instruction.max = pattern->max_repeat;
+    if (pattern->lazy)
+      instruction.flags |= Instruction::Lazy;
 
-  if (pos == std::string::npos) // pattern not found
+    m_program.add(instruction);
+  }
+
+  // backreferences need the captured text so only the backtracker handles them
+  if (!needsBacktracking())
   {
-    if (!m_patternList[pattern]->optional)
+    m_nfa = std::make_unique<Nfa>();
+
+    if (m_patternSet)
     {
-#if DEBUGGING
-      std::cout << "6 pattern " << pattern << " failed\n";
-#endif
-      return pos;
+      // every pattern gets its own match state so the NFA can tell which ones matched
+      const AlternationPattern* alternation = static_cast<const AlternationPattern*>(m_patternList[0].get());
+      std::vector<Nfa::Fragment> fragments;
+
+      for (std::size_t branch = 0; branch < alternation->branches().size(); ++branch)
+        fragments.push_back(addToNfa(*m_nfa, alternation->branches()[branch], alternation->branch_end(branch)));
+
+      m_nfa->finish(fragments);
+    }
+    else
+    {
+      m_nfa->finish(addToNfa(*m_nfa));
     }
-    pos = preCheckPos;
   }
-  else if (m_patternList[pattern]->one_or_more) // need to check for multiple?
+
+  analyseAnchors();
+
+  // lines without the required literal can be skipped before matching
+  if (std::string literal = requiredLiteral(); !literal.empty())
+    m_prefilter = std::make_unique<LiteralPrefilter>(literal);
+
+  analyseSuffix();
+
+  // an alternation of plain literals is found without running the NFA at all
+  if (std::vector<std::string> keywords = literalAlternation(); !keywords.empty())
+    m_keywords = std::make_unique<AhoCorasick>(keywords);
+
+  // keywords already say exactly which patterns matched, and a DFA over a
+  // few patterns is as quick as looking up which of them could match
+  if (m_patternSet && !m_keywords && (!m_nfa || m_nfa->patternCount() >= CANDIDATE_FRACTION))
+    indexPatternSet();
+}
+
+/**********************************************************************
+ * analyseAnchors
+ *
+ * Description: Works out where a leading '^' and a trailing '$' pin a
+ *      match, along with the literals right next to them, so inputs
+ *      can be checked at their ends before being searched
+ *********************************************************************/
+void CompiledPattern::analyseAnchors()
+{
+  // a '|' outside of any group lets every branch ignore the anchors
+  if (m_patternSet || m_patternList.empty() || m_patternList[0]->type == PatternType::Alternation)
+    return;
+
+  // the runs stop at the first pattern that isn't a literal or could repeat a varying number of times
+  const Pattern* first = m_patternList.front().get();
+  if (dynamic_cast<const StartAnchorPattern*>(first) && !first->is_optional())
   {
-    preCheckPos = pos;
-    pos = findPatterns(input, pos, pattern, true);
+    m_startAnchored = true;
 
-    if (pos != std::string::npos) // subsequent pattern was found so no need to keep checking
+    for (std::size_t i = 1; i < m_patternList.size(); ++i)
     {
-#if DEBUGGING
-      std::cout << "6.5 after pattern " << pattern << " succeded\n";
-#endif
-      return pos;
+      const LiteralCharacterPattern* literal = dynamic_cast<const LiteralCharacterPattern*>(m_patternList[i].get());
+      if (!literal)
+        break;
+
+      m_anchoredPrefix.append(literal->min_repeat, literal->character());
+      if (literal->max_repeat > literal->min_repeat)
+        break;
     }
+  }
+
+  const Pattern* last = m_patternList.back().get();
+  if (dynamic_cast<const EndAnchorPattern*>(last) && !last->is_optional())
+  {
+    for (std::size_t i = m_patternList.size() - 1; i-- > 0;)
+    {
+      const LiteralCharacterPattern* literal = dynamic_cast<const LiteralCharacterPattern*>(m_patternList[i].get());
+      if (!literal)
+        break;
 
-    pos = preCheckPos;
+      m_anchoredSuffix.insert(0, literal->min_repeat, literal->character());
+      if (literal->max_repeat > literal->min_repeat)
+        break;
+    }
   }
-  else if (m_patternList[pattern]->optional)
+}
+
+/**********************************************************************
+ * anchorsRuleOut
+ *
+ * Description: Compares the ends of the input with the literals next to
+ *      the anchors, which only looks at a few bytes where a search
+ *      would read the whole input
+ *
+ * Parameters:
+ *   input: the string to search
+ *
+ * Returns: true if the input can't match
+ *********************************************************************/
+bool CompiledPattern::anchorsRuleOut(std::string_view input) const
+{
+  bool ruledOut = !input.starts_with(m_anchoredPrefix) || !input.ends_with(m_anchoredSuffix);
+
+#if GREP_STATS
+  if (!m_anchoredPrefix.empty() || !m_anchoredSuffix.empty())
+    m_anchorStats.record(!ruledOut);
+#endif
+
+  return ruledOut;
+}
+
+/**********************************************************************
+ * literalsRuleOut
+ *
+ * Description: Looks for the literals a match needs, the required
+ *      literal, the keywords of a literal alternation or the literals a
+ *      pattern set is indexed by
+ *
+ * Parameters:
+ *   input: the string to search
+ *   prefilterFound: the caller already found the required literal
+ *
+ * Returns: true if the input can't match
+ *********************************************************************/
+bool CompiledPattern::literalsRuleOut(std::string_view input, bool prefilterFound) const
+{
+  if (m_prefilter && !prefilterFound)
   {
-    startsWith |= initialPos != pos;
-    pos = findPatterns(input, pos, pattern+1, startsWith);
+    bool found = m_prefilter->find(input) != std::string_view::npos;
 
-    if (pos != std::string::npos) // subsequent pattern was found with the optional existing
-    {
-#if DEBUGGING
-      std::cout << "6.6 after pattern " << pattern << " succeded\n";
+#if GREP_STATS
+    m_prefilterStats.record(found);
 #endif
-      return pos;
-    }
 
-    // no matching pattern worked with the optional existing so try without
-    pos = preCheckPos;
+    if (!found)
+      return true;
   }
 
+  if (m_keywords)
+  {
+    bool found = m_keywords->find(input) != std::string_view::npos;
 
-#if DEBUGGING
-  std::cout << "6.7 " << pos << " " << pattern << std::endl;
+#if GREP_STATS
+    m_keywordStats.record(found);
+#endif
+
+    if (!found)
+      return true;
+  }
+
+  if (const AhoCorasick* literals = setLiterals())
+  {
+    bool found = literals->find(input) != std::string_view::npos;
+
+#if GREP_STATS
+    m_setLiteralStats.record(found);
+#endif
+
+    if (!found)
+      return true;
+  }
+
+  return false;
+}
+
+/**********************************************************************
+ * analyseSuffix
+ *
+ * Description: Sets up the reverse suffix search for a pattern ending
+ *      in its rarest literal. The literal is found with the prefilter's
+ *      substring search and the rest of the pattern is matched backwards
+ *      from each copy of it, so the bytes before a match are never read
+ *      the way a forward search has to
+ *********************************************************************/
+void CompiledPattern::analyseSuffix()
+{
+  if (!m_nfa || !m_prefilter || m_patternSet || m_patternList.empty() ||
+      m_patternList[0]->type == PatternType::Alternation)
+    return;
+
+  std::size_t last = m_patternList.size();
+  const Pattern* end = m_patternList.back().get();
+  bool atEnd = dynamic_cast<const EndAnchorPattern*>(end) && !end->is_optional();
+  if (atEnd)
+    --last;
+
+  std::string suffix;
+  std::size_t first = last;
+
+  for (; first > 0; --first)
+  {
+    const LiteralCharacterPattern* literal = dynamic_cast<const LiteralCharacterPattern*>(m_patternList[first - 1].get());
+    if (!literal || literal->max_repeat != literal->min_repeat)
+      break;
+
+    suffix.insert(0, literal->min_repeat, literal->character());
+  }
+
+  // a plain literal needs nothing more than the prefilter, and the suffix
+  // has to be as rare as anything else the pattern needs
+  if (first == 0 || suffix.size() < m_prefilter->literal().size())
+    return;
+
+  // a literal earlier on is skipped to by the forward search, where reading
+  // backwards would have to read until it is found
+  if (!requiredLiteral(0, first).empty())
+    return;
+
+  // a '$' before the suffix could never pass
+  for (std::size_t i = 0; i < first; ++i)
+  {
+    if (dynamic_cast<const EndAnchorPattern*>(m_patternList[i].get()))
+      return;
+  }
+
+  // the '^' makes the reversed search a single attempt from where the suffix starts
+  m_reverseNfa = std::make_unique<Nfa>();
+  m_reverseNfa->finish(m_reverseNfa->concatenate(m_reverseNfa->assertStart(), addToNfa(*m_reverseNfa, 0, first, true)));
+  m_suffix = std::make_unique<LiteralPrefilter>(suffix);
+  m_suffixAtEnd = atEnd;
+}
+
+/**********************************************************************
+ * matchesSuffix
+ *
+ * Description: Looks for a match with the reverse suffix search. Each
+ *      backwards match reads from a copy of the suffix towards the
+ *      start, so copies close together could read the same bytes over
+ *      and over, once as much as the whole input has been read the
+ *      forward DFA is run instead
+ *
+ * Parameters:
+ *   input: the string to search, anchors refer to its ends
+ *   from: the first position the suffix may start at
+ *
+ * Returns: true if there is a match ending with a suffix after from
+ *********************************************************************/
+bool CompiledPattern::matchesSuffix(std::string_view input, std::size_t from) const
+{
+  const std::string& suffix = m_suffix->literal();
+  std::size_t budget = input.size();
+  bool found = false;
+
+  if (m_suffixAtEnd)
+  {
+    found = input.size() >= from + suffix.size() && input.ends_with(suffix) &&
+            m_reverseNfa->matchesBackward(input.substr(0, input.size() - suffix.size()), budget);
+  }
+  else
+  {
+    for (std::size_t pos = m_suffix->find(input, from); pos != std::string::npos; pos = m_suffix->find(input, pos + 1))
+    {
+      if ((found = m_reverseNfa->matchesBackward(input.substr(0, pos), budget)))
+        break;
+
+      if (budget == 0)
+      {
+        found = m_nfa->matches(input);
+        break;
+      }
+    }
+  }
+
+#if GREP_STATS
+  m_suffixStats.record(found);
 #endif
-  // if this one didnt need to start and we got a non matching pattern (didnt check the input)
-  // the next one doesnt either
-  startsWith |= initialPos != pos;
 
-  if (m_patternList[pattern]->forceStart)
-    startsWith = true;
+  return found;
+}
+
+/**********************************************************************
+ * indexPatternSet
+ *
+ * Description: Collects the literals each pattern of a pattern set
+ *      needs into one automaton, a single pass over a line then gives
+ *      every pattern that could match it. Patterns often share a
+ *      literal so each literal is only searched for once
+ *********************************************************************/
+void CompiledPattern::indexPatternSet()
+{
+  const AlternationPattern* alternation = static_cast<const AlternationPattern*>(m_patternList[0].get());
+  std::map<std::string, std::vector<std::uint32_t>> literalPatterns;
+
+  for (std::size_t branch = 0; branch < alternation->branches().size(); ++branch)
+  {
+    std::vector<std::string> required = requiredLiterals(alternation->branches()[branch], alternation->branch_end(branch));
+
+    if (required.empty())
+      m_unindexedPatterns.push_back(branch);
+
+    for (const std::string& literal : required)
+    {
+      std::vector<std::uint32_t>& patterns = literalPatterns[literal];
+
+      if (patterns.empty() || patterns.back() != branch)
+        patterns.push_back(branch);
+    }
+  }
+
+  // when a literal is shared by more patterns than are ever run alone, finding
+  // it only says to run the whole set, so the index has to be selective
+  std::size_t indexed = 0;
+  for (const auto& [literal, patterns] : literalPatterns)
+    indexed += patterns.size();
+
+  if (literalPatterns.empty() || (m_nfa && indexed * CANDIDATE_FRACTION > literalPatterns.size() * m_nfa->patternCount()))
+  {
+    m_unindexedPatterns.clear();
+    return;
+  }
+
+  std::vector<std::string> literals;
+  m_literalStarts.push_back(0);
+
+  for (const auto& [literal, patterns] : literalPatterns)
+  {
+    literals.push_back(literal);
+    m_literalPatterns.insert(m_literalPatterns.end(), patterns.begin(), patterns.end());
+    m_literalStarts.push_back(m_literalPatterns.size());
+  }
+
+  m_setLiterals = std::make_unique<AhoCorasick>(literals);
+
+  if (m_nfa)
+  {
+    m_patternNfas.resize(m_nfa->patternCount());
+    m_patternNfasSplit = std::make_unique<std::once_flag[]>(m_nfa->patternCount());
+  }
+}
+
+/**********************************************************************
+ * patternNfa
+ *
+ * Description: Gets one pattern of an indexed pattern set on its own,
+ *      a line's few candidates then run small DFAs instead of one
+ *      whose states hold every pattern. Each is copied out of the set's
+ *      NFA the first time it is a candidate since most never are
+ *
+ * Parameters:
+ *   pattern: the index of the pattern
+ *
+ * Returns: the pattern's NFA
+ *********************************************************************/
+const Nfa& CompiledPattern::patternNfa(std::size_t pattern) const
+{
+  std::call_once(m_patternNfasSplit[pattern], [this, pattern]() { m_patternNfas[pattern] = std::make_unique<Nfa>(*m_nfa, pattern); });
+
+  return *m_patternNfas[pattern];
+}
+
+/**********************************************************************
+ * match
+ *
+ * Description: Runs the NFA when possible, otherwise runs the
+ *      backtracking program with fresh group storage so the same
+ *      compiled patterns can be used by many callers at once
+ *
+ * Parameters:
+ *   input: the string to search for the patterns
+ *   startsWith: Whether or not the input must start with the pattern
+ *
+ * Returns: the position after all of the patterns have been matched
+ *      npos if no match
+ *********************************************************************/
+std::size_t CompiledPattern::match(std::string_view input, bool startsWith) const
+{
+  if (anchorsRuleOut(input) || literalsRuleOut(input))
+    return std::string::npos;
+
+  if (m_nfa)
+    return m_nfa->find(input, startsWith);
+
+  MatchState state(m_referenceCount);
+  std::size_t start;
+
+  return m_program.search(input, 0, 0, startsWith, state, start);
+}
+
+/**********************************************************************
+ * find
+ *
+ * Description: Finds the first match starting at or after from along
+ *      with its groups. Without backreferences the NFA's pike VM finds
+ *      the span and groups in linear time once the filters and the DFA
+ *      haven't ruled the input out, only backreferences need the
+ *      program
+ *
+ * Parameters:
+ *   input: the string to search for the patterns, anchors refer to its
+ *       ends whatever from is
+ *   from: the first position a match may start at
+ *   start: set to where the match starts
+ *   state: storage for groupCount() groups, set to what they captured
+ *
+ * Returns: the position after the match, npos if no match
+ *********************************************************************/
+std::size_t CompiledPattern::find(std::string_view input, std::size_t from, std::size_t& start, MatchState& state) const
+{
+  if (m_loadedFromCache)
+    throw std::runtime_error("Patterns loaded from a cache can't report match positions");
+
+  // '^' only matches at the start of the whole input
+  if (from > input.size() || (m_startAnchored && from > 0) || anchorsRuleOut(input))
+    return std::string::npos;
+
+  if (literalsRuleOut(input.substr(from)))
+    return std::string::npos;
+
+  // a '^' could match at from in the slice so the DFA only decides for whole inputs
+  if (m_reverseNfa)
+  {
+    if (!matchesSuffix(input, from))
+      return std::string::npos;
+  }
+  else if (m_nfa && from == 0 && !m_nfa->matches(input))
+  {
+    return std::string::npos;
+  }
+
+  if (!m_nfa)
+    return m_program.search(input, from, 0, false, state, start);
+
+  std::vector<std::size_t> captures(2 * m_referenceCount + 2);
+  std::size_t end = m_nfa->find(input, from, captures);
+
+  if (end == std::string::npos)
+    return std::string::npos;
+
+  start = captures[0];
+
+  for (std::size_t group = 0; group < m_referenceCount; ++group)
+  {
+    // a group that was entered but never finished took no part in the match
+    bool took = captures[2 * group + 3] != std::string::npos && captures[2 * group + 2] != std::string::npos;
+    state[group].start = took ? captures[2 * group + 2] : std::string::npos;
+    state[group].end = took ? captures[2 * group + 3] : std::string::npos;
+  }
+
+  return end;
+}
+
+/**********************************************************************
+ * matches
+ *
+ * Description: Checks if the patterns appear anywhere in the input, the
+ *      end position isn't needed so the lazy DFA can be used
+ *
+ * Parameters:
+ *   input: the string to search for the patterns
+ *   prefilterFound: the caller already found the required literal in
+ *       the input so it isn't looked for again
+ *
+ * Returns: true if the patterns were found
+ *********************************************************************/
+bool CompiledPattern::matches(std::string_view input, bool prefilterFound) const
+{
+  if (anchorsRuleOut(input))
+    return false;
+
+  // the suffix search looks for the prefilter's literal itself
+  if (m_reverseNfa)
+    return matchesSuffix(input, 0);
+
+  if (literalsRuleOut(input, prefilterFound))
+    return false;
+
+  // finding one of the keywords is a match
+  if (m_keywords)
+    return true;
+
+  if (m_nfa)
+    return m_nfa->matches(input);
+
+  return match(input) != std::string::npos;
+}
+
+/**********************************************************************
+ * matchingPatterns
+ *
+ * Description: Finds which patterns of a pattern set appear anywhere in
+ *      the input, a single pattern is reported as pattern 0
+ *
+ * Parameters:
+ *   input: the string to search for the patterns
+ *   patterns: set to the index of each pattern found, in index order
+ *********************************************************************/
+void CompiledPattern::matchingPatterns(std::string_view input, std::vector<std::size_t>& patterns) const
+{
+  patterns.clear();
+
+  if (!m_patternSet)
+  {
+    if (matches(input))
+      patterns.push_back(0);
+  }
+  else if (m_keywords)
+  {
+    m_keywords->findAll(input, patterns);
+  }
+  else if (m_nfa && !m_setLiterals)
+  {
+    m_nfa->matchingPatterns(input, patterns);
+  }
+  else
+  {
+    std::vector<std::size_t> candidates;
+
+    // only the patterns whose literals are in the input can match, the
+    // literals found are collected in patterns to save an allocation
+    if (m_setLiterals)
+    {
+      // the DFA runs the whole set in one pass, which beats running more than a few candidates alone
+      std::size_t limit = m_nfa ? m_nfa->patternCount() / CANDIDATE_FRACTION : std::numeric_limits<std::size_t>::max();
+      bool few = m_setLiterals->findAll(input, patterns, limit);
+
+      std::size_t count = m_unindexedPatterns.size();
+      for (std::size_t literal : patterns)
+        count += m_literalStarts[literal + 1] - m_literalStarts[literal];
+
+#if GREP_STATS
+      m_setLiteralStats.record(count > 0);
+#endif
+
+      if (m_nfa && (!few || count > limit))
+      {
+        m_nfa->matchingPatterns(input, patterns);
+        return;
+      }
+
+      for (std::size_t literal : patterns)
+        candidates.insert(candidates.end(), m_literalPatterns.begin() + m_literalStarts[literal], m_literalPatterns.begin() + m_literalStarts[literal + 1]);
+
+      candidates.insert(candidates.end(), m_unindexedPatterns.begin(), m_unindexedPatterns.end());
+      std::sort(candidates.begin(), candidates.end());
+      candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+      patterns.clear();
+    }
+    else
+    {
+      candidates.resize(static_cast<const AlternationPattern*>(m_patternList[0].get())->branches().size());
+      std::iota(candidates.begin(), candidates.end(), 0);
+    }
+
+#if GREP_STATS
+    m_candidatesRun.add(candidates.size());
+#endif
+
+    if (m_nfa)
+    {
+      for (std::size_t pattern : candidates)
+      {
+        if (patternNfa(pattern).matches(input))
+          patterns.push_back(pattern);
+      }
+
+      return;
+    }
+
+    // each branch runs on its own, reaching its marker ends the whole set
+    const AlternationPattern* alternation = static_cast<const AlternationPattern*>(m_patternList[0].get());
+    MatchState state(m_referenceCount);
+    std::size_t start;
+
+    for (std::size_t branch : candidates)
+    {
+      if (m_program.search(input, 0, alternation->branches()[branch], false, state, start) != std::string::npos)
+        patterns.push_back(branch);
+    }
+  }
+}
+
+#if GREP_STATS
+/**********************************************************************
+ * writeStats
+ *
+ * Description: Writes how often each prefilter ruled an input out and
+ *      what the automata and the program did with the rest. Only the
+ *      parts this pattern has are written
+ *
+ * Parameters:
+ *   json: where to write the counts
+ *********************************************************************/
+void CompiledPattern::writeStats(JsonWriter& json) const
+{
+  json.beginObject("filters");
+
+  if (!m_anchoredPrefix.empty() || !m_anchoredSuffix.empty())
+    json.filter("anchors", m_anchorStats);
+
+  if (m_prefilter)
+    json.filter("prefilter", m_prefilterStats);
+
+  if (m_keywords)
+    json.filter("keywords", m_keywordStats);
+
+  if (m_setLiterals)
+    json.filter("set_literals", m_setLiteralStats);
+
+  if (m_suffix)
+    json.filter("suffix", m_suffixStats);
+
+  json.endObject();
+
+  if (m_nfa)
+  {
+    json.beginObject("nfa");
+    m_nfa->writeStats(json);
+    json.endObject();
+  }
+
+  if (m_reverseNfa)
+  {
+    json.beginObject("reverse_nfa");
+    m_reverseNfa->writeStats(json);
+    json.endObject();
+  }
+
+  // only the patterns that were ever candidates on their own have an NFA of their own
+  if (m_setLiterals)
+  {
+    json.field("candidates_run", m_candidatesRun.value());
+    json.beginArray("pattern_nfas");
+
+    for (std::size_t pattern = 0; pattern < m_patternNfas.size(); ++pattern)
+    {
+      if (!m_patternNfas[pattern])
+        continue;
+
+      json.beginObject();
+      json.field("pattern", static_cast<std::uint64_t>(pattern));
+      m_patternNfas[pattern]->writeStats(json);
+      json.endObject();
+    }
+
+    json.endArray();
+  }
+
+  // patterns loaded from a cache have no program
+  if (!m_loadedFromCache)
+    m_program.writeStats(json);
+}
+#endif
+
+/**********************************************************************
+ * addToNfa
+ *
+ * Description: Adds every pattern to the NFA in order
+ *
+ * Parameters:
+ *   nfa: the NFA to add the states to
+ *
+ * Returns: the fragment matching all of the patterns
+ *********************************************************************/
+Nfa::Fragment CompiledPattern::addToNfa(Nfa& nfa) const
+{
+  return addToNfa(nfa, 0, m_patternList.size());
+}
+
+/**********************************************************************
+ * addToNfa
+ *
+ * Description: Adds a run of the pattern list to the NFA, a reference
+ *      is added as one fragment so a quantifier on its end applies to
+ *      the whole reference and each branch of an alternation becomes
+ *      one side of an NFA alternation
+ *
+ * Parameters:
+ *   nfa: the NFA to add the states to
+ *   first: index of the first pattern to add
+ *   last: index one past the last pattern to add
+ *   reverse: whether to add the patterns last to first, matching the
+ *       reversed text
+ *
+ * Returns: the fragment matching the patterns
+ *********************************************************************/
+Nfa::Fragment CompiledPattern::addToNfa(Nfa& nfa, std::size_t first, std::size_t last, bool reverse) const
+{
+  Nfa::Fragment result = nfa.empty();
+
+  for (std::size_t i = first; i < last; ++i)
+  {
+    const Pattern* pattern = m_patternList[i].get();
+    std::size_t end = i;
+    const Pattern* quantified = pattern;
+
+    // the quantifiers for the reference are on its end
+    if (const AlternationPattern* alternation = dynamic_cast<const AlternationPattern*>(pattern))
+    {
+      end = alternation->end() - 1;
+    }
+    else if (const ReferencePattern* reference = dynamic_cast<const ReferencePattern*>(pattern))
+    {
+      end = reference->end();
+      quantified = m_patternList[end].get();
+    }
+
+    Nfa::Fragment repeat = addRepeatToNfa(nfa, i, *quantified, reverse);
+    result = reverse ? nfa.concatenate(repeat, result) : nfa.concatenate(result, repeat);
+    i = end;
+  }
+
+  return result;
+}
+
+/**********************************************************************
+ * addOnceToNfa
+ *
+ * Description: Adds one copy of a pattern to the NFA without its
+ *      quantifier, a reference or alternation is added whole
+ *
+ * Parameters:
+ *   nfa: the NFA to add the states to
+ *   first: index of the pattern to add
+ *   reverse: whether the pattern is for the reversed text
+ *
+ * Returns: the fragment matching the pattern once
+ *********************************************************************/
+Nfa::Fragment CompiledPattern::addOnceToNfa(Nfa& nfa, std::size_t first, bool reverse) const
+{
+  const Pattern* pattern = m_patternList[first].get();
+
+  if (const AlternationPattern* alternation = dynamic_cast<const AlternationPattern*>(pattern))
+  {
+    // every branch but the last stops at the marker before the next one
+    const std::vector<std::size_t>& branches = alternation->branches();
+    Nfa::Fragment fragment = addToNfa(nfa, branches.back(), alternation->end(), reverse);
+
+    for (std::size_t branch = branches.size() - 1; branch > 0; --branch)
+      fragment = nfa.alternate(addToNfa(nfa, branches[branch-1], alternation->branch_end(branch-1), reverse), fragment);
+
+    return fragment;
+  }
+
+  // a group records where it starts and ends for find(), slots 0 and 1 are the whole match's.
+  // Reading backwards only ever asks whether there is a match so it has no captures
+  if (const ReferencePattern* reference = dynamic_cast<const ReferencePattern*>(pattern))
+  {
+    Nfa::Fragment group = addToNfa(nfa, first + 1, reference->end(), reverse);
+    if (reverse)
+      return group;
+
+    int slot = 2 * reference->index() + 2;
+    return nfa.concatenate(nfa.save(slot), nfa.concatenate(group, nfa.save(slot + 1)));
+  }
+
+  // read backwards the anchors swap ends
+  if (reverse && dynamic_cast<const StartAnchorPattern*>(pattern))
+    return nfa.assertEnd();
+
+  if (reverse && dynamic_cast<const EndAnchorPattern*>(pattern))
+    return nfa.assertStart();
+
+  return pattern->add_to_nfa(nfa);
+}
+
+/**********************************************************************
+ * addRepeatToNfa
+ *
+ * Description: Adds a pattern with its quantifier to the NFA. The NFA
+ *      has no counters so a counted repeat gets a copy per repeat, the
+ *      copies past the minimum are nested so there is only one way to
+ *      match each count
+ *
+ * Parameters:
+ *   nfa: the NFA to add the states to
+ *   first: index of the pattern to add
+ *   quantified: the pattern holding the quantifier, the reference's end
+ *       for a reference
+ *   reverse: whether the pattern is for the reversed text, the copies
+ *       are all alike so only the pattern itself is reversed
+ *
+ * Returns: the fragment matching the repeated pattern
+ *********************************************************************/
+Nfa::Fragment CompiledPattern::addRepeatToNfa(Nfa& nfa, std::size_t first, const Pattern& quantified, bool reverse) const
+{
+  std::uint32_t min = quantified.min_repeat, max = quantified.max_repeat;
+  bool lazy = quantified.lazy;
+
+  if (min == 1 && max == 1)
+    return addOnceToNfa(nfa, first, reverse);
+
+  if (max == 0)
+    return nfa.empty();
+
+  Nfa::Fragment result = nfa.empty();
+
+  for (std::uint32_t count = 0; count < min; ++count)
+  {
+    // the last required copy loops when there is no limit
+    if (count + 1 == min && max == Pattern::UNBOUNDED)
+      result = nfa.concatenate(result, nfa.oneOrMore(addOnceToNfa(nfa, first, reverse), lazy));
+    else
+      result = nfa.concatenate(result, addOnceToNfa(nfa, first, reverse));
+  }
+
+  if (max == Pattern::UNBOUNDED)
+  {
+    if (min == 0)
+      result = nfa.concatenate(result, nfa.optional(nfa.oneOrMore(addOnceToNfa(nfa, first, reverse), lazy), lazy));
+
+    return result;
+  }
+
+  if (max > min)
+  {
+    Nfa::Fragment optional = nfa.optional(addOnceToNfa(nfa, first, reverse), lazy);
+
+    for (std::uint32_t count = min + 1; count < max; ++count)
+      optional = nfa.optional(nfa.concatenate(addOnceToNfa(nfa, first, reverse), optional), lazy);
+
+    result = nfa.concatenate(result, optional);
+  }
+
+  return result;
+}
+
+/**********************************************************************
+ * unrolledSize
+ *
+ * Description: Works out how many patterns the NFA gets for part of the
+ *      pattern list once addRepeatToNfa() has copied out every counted
+ *      repeat, a group's copies hold copies of whatever repeats inside it
+ *
+ * Parameters:
+ *   first: index of the first pattern
+ *   last: index of the pattern after the last one
+ *
+ * Returns: the number of patterns after copying
+ *********************************************************************/
+std::uint64_t CompiledPattern::unrolledSize(std::size_t first, std::size_t last) const
+{
+  // an unbounded repeat loops on its last required copy
+  auto copies = [](const Pattern& quantified) -> std::uint64_t
+  {
+    return quantified.max_repeat == Pattern::UNBOUNDED ? std::max<std::uint32_t>(quantified.min_repeat, 1) : quantified.max_repeat;
+  };
+
+  std::uint64_t size = 0;
+
+  for (std::size_t i = first; i < last; ++i)
+  {
+    if (const ReferencePattern* reference = dynamic_cast<const ReferencePattern*>(m_patternList[i].get()))
+    {
+      size += unrolledSize(i + 1, reference->end()) * copies(*m_patternList[reference->end()]);
+      i = reference->end();
+    }
+    else
+    {
+      size += copies(*m_patternList[i]);
+    }
+  }
+
+  return size;
+}
+
+/**********************************************************************
+ * requiredLiteral
+ *
+ * Description: Finds the longest run of literal characters that every
+ *      match of the whole pattern list must contain
+ *
+ * Returns: the literal, empty if there isn't one
+ *********************************************************************/
+std::string CompiledPattern::requiredLiteral() const
+{
+  return requiredLiteral(0, m_patternList.size());
+}
+
+/**********************************************************************
+ * requiredLiteral
+ *
+ * Description: Finds the longest run of literal characters that every
+ *      match of some of the patterns must contain, patterns in an
+ *      optional reference can't be relied on and anything else that
+ *      isn't a single literal character ends the run
+ *
+ * Parameters:
+ *   first: the first pattern
+ *   last: one past the last pattern, references and alternations
+ *       can't cross it
+ *
+ * Returns: the literal, empty if there isn't one
+ *********************************************************************/
+std::string CompiledPattern::requiredLiteral(std::size_t first, std::size_t last) const
+{
+  std::vector<bool> required(m_patternList.size(), true);
+  std::vector<std::size_t> referenceStarts;
+
+  for (std::size_t i = first; i < last; ++i)
+  {
+    const Pattern* pattern = m_patternList[i].get();
+
+    if (dynamic_cast<const ReferencePattern*>(pattern))
+    {
+      referenceStarts.push_back(i);
+    }
+    else if (dynamic_cast<const EndReferencePattern*>(pattern))
+    {
+      if (pattern->is_optional())
+        std::fill(required.begin() + referenceStarts.back(), required.begin() + i + 1, false);
+
+      referenceStarts.pop_back();
+    }
+    else if (const AlternationPattern* alternation = dynamic_cast<const AlternationPattern*>(pattern))
+    {
+      // only one branch has to match so none of them can be relied on
+      std::fill(required.begin() + i, required.begin() + alternation->end(), false);
+    }
+  }
+
+  std::string longest, current;
+
+  for (std::size_t i = first; i < last; ++i)
+  {
+    const Pattern* pattern = m_patternList[i].get();
+    const LiteralCharacterPattern* literal = dynamic_cast<const LiteralCharacterPattern*>(pattern);
+
+    if (required[i] && literal && !pattern->is_optional())
+    {
+      current.append(pattern->min_repeat, literal->character());
+
+      // the run can't continue past a variable repeat but the last repeats start the next run
+      if (pattern->max_repeat > pattern->min_repeat)
+      {
+        if (current.size() > longest.size())
+          longest = current;
+        current = std::string(pattern->min_repeat, literal->character());
+      }
+
+      continue;
+    }
+
+    // zero width patterns don't break the run unless they repeat
+    if (required[i] && !pattern->can_repeat() &&
+        (dynamic_cast<const ReferencePattern*>(pattern) || dynamic_cast<const EndReferencePattern*>(pattern) ||
+         dynamic_cast<const StartAnchorPattern*>(pattern) || dynamic_cast<const EndAnchorPattern*>(pattern)))
+      continue;
+
+    if (current.size() > longest.size())
+      longest = current;
+    current.clear();
+  }
+
+  if (current.size() > longest.size())
+    longest = current;
+
+  return longest;
+}
+
+/**********************************************************************
+ * requiredLiterals
+ *
+ * Description: Finds literals that every match of some of the patterns
+ *      must contain one of, a top level alternation needs one from each
+ *      branch since any branch could be the one that matches
+ *
+ * Parameters:
+ *   first: the first pattern
+ *   last: one past the last pattern
+ *
+ * Returns: the literals, empty if a match might not contain any
+ *********************************************************************/
+std::vector<std::string> CompiledPattern::requiredLiterals(std::size_t first, std::size_t last) const
+{
+  if (std::string literal = requiredLiteral(first, last); !literal.empty())
+    return {literal};
+
+  if (first >= last || m_patternList[first]->type != PatternType::Alternation)
+    return {};
+
+  const AlternationPattern* alternation = static_cast<const AlternationPattern*>(m_patternList[first].get());
+  if (alternation->end() != last || alternation->can_repeat())
+    return {};
+
+  std::vector<std::string> literals;
+
+  for (std::size_t branch = 0; branch < alternation->branches().size(); ++branch)
+  {
+    std::string literal = requiredLiteral(alternation->branches()[branch], alternation->branch_end(branch));
+
+    if (literal.empty())
+      return {};
+
+    literals.push_back(literal);
+  }
+
+  return literals;
+}
+
+/**********************************************************************
+ * literalAlternation
+ *
+ * Description: Checks if the patterns are just an alternation of plain
+ *      literals, optionally in one reference, so any of the literals
+ *      being in the input is a match
+ *
+ * Returns: the literal in each branch, empty if the patterns are
+ *      anything else
+ *********************************************************************/
+std::vector<std::string> CompiledPattern::literalAlternation() const
+{
+  std::size_t first = 0, last = m_patternList.size();
+
+  // a reference around the whole alternation doesn't change what matches
+  if (last >= 2 && m_patternList[0]->type == PatternType::Reference &&
+      static_cast<const ReferencePattern*>(m_patternList[0].get())->end() == last - 1 &&
+      m_patternList[last-1]->min_repeat == 1 && m_patternList[last-1]->max_repeat == 1)
+  {
+    ++first;
+    --last;
+  }
+
+  if (first >= last || m_patternList[first]->type != PatternType::Alternation)
+    return {};
+
+  const AlternationPattern* alternation = static_cast<const AlternationPattern*>(m_patternList[first].get());
+  if (alternation->end() != last)
+    return {};
+
+  const std::vector<std::size_t>& branches = alternation->branches();
+  std::vector<std::string> keywords;
+
+  for (std::size_t branch = 0; branch < branches.size(); ++branch)
+  {
+    std::string keyword;
+
+    for (std::size_t i = branches[branch]; i < alternation->branch_end(branch); ++i)
+    {
+      const Pattern* pattern = m_patternList[i].get();
+      const LiteralCharacterPattern* literal = dynamic_cast<const LiteralCharacterPattern*>(pattern);
+
+      if (!literal || pattern->min_repeat != 1 || pattern->max_repeat != 1)
+        return {};
+
+      keyword += literal->character();
+    }
+
+    // an empty branch matches everywhere
+    if (keyword.empty())
+      return {};
+
+    keywords.push_back(keyword);
+  }
+
+  return keywords;
+}
+
+/**********************************************************************
+ * needsBacktracking
+ *
+ * Returns: true if any pattern can't be turned into NFA states
+ *********************************************************************/
+bool CompiledPattern::needsBacktracking() const
+{
+  return std::any_of(m_patternList.begin(), m_patternList.end(), [](const std::unique_ptr<Pattern>& pattern) { return pattern->needs_backtracking(); });
+}
+
+/**********************************************************************
+ * PatternHandler
+ *
+ * Description: Compiles the patterns so they can be matched against
+ *      any number of inputs with match()
+ *
+ * Parameters:
+ *   patterns: the string with all of the patterns
+ *********************************************************************/
+PatternHandler::PatternHandler(const std::string& patterns)
+: m_compiled(patterns)
+{
+}
+
+/**********************************************************************
+ * PatternHandler
+ *
+ * Description: Compiles the patterns then matches them against input
+ *
+ * Parameters:
+ *   input: the string to search for the patterns
+ *   patterns: the string with all of the patterns
+ *   startsWith: Whether or not the input must start with the pattern
+ *
+ * Returns: the position after all of the patterns have been matched
+ *      npos if no match
+ *********************************************************************/
+PatternHandler::PatternHandler(const std::string& input, const std::string& patterns, bool startsWith)
+: PatternHandler(patterns)
+{
+  match(input, startsWith);
+}
 
-  // pattern was found so go to next
-  newPos = findPatterns(input, pos, pattern+1, startsWith);
+/**********************************************************************
+ * match
+ *
+ * Description: Runs the compiled patterns against a new input
+ *
+ * Parameters:
+ *   input: the string to search for the patterns
+ *   startsWith: Whether or not the input must start with the pattern
+ *
+ * Returns: the position after all of the patterns have been matched
+ *      npos if no match
+ *********************************************************************/
+std::size_t PatternHandler::match(std::string_view input, bool startsWith)
+{
+  m_result = m_compiled.match(input, startsWith);
 
-  return newPos;
+  return m_result;
 }
 
 /**********************************************************************
@@ -234,11 +1502,10 @@ std::size_t PatternHandler::findPatterns(const std::string& input, std::size_t p
  *   patterns: string of all patterns desired, will have used pattern
  *       removed
  *********************************************************************/
-void PatternHandler::addPatternFromPatternString(std::string& patterns)
+void CompiledPattern::addPatternFromPatternString(PatternCursor& patterns)
 {
-  // referenceIndex tracks the total references added
-  static int referenceIndex = 0;
   std::size_t prevSize = m_patternList.size();
+  PatternCursor patternStart = patterns;
 
   // order is important here
   if (StartAnchorPattern::is_this_pattern(patterns))
@@ -271,79 +1538,168 @@ void PatternHandler::addPatternFromPatternString(std::string& patterns)
   }
   else if (AlternationPattern::is_this_pattern(patterns))
   {
-    m_patternReferences.emplace_back(std::make_shared<std::string>());
-
-    std::shared_ptr<std::size_t> referenceStart = std::make_shared<std::size_t>();
-    m_referenceStarts.emplace_back(referenceStart);
-
-    m_referenceIndexs.emplace_back(referenceIndex);
+    m_referenceIndexs.emplace_back(m_referenceCount);
 
 #if DEBUGGING
-    std::cout << "starting reference " << referenceIndex << std::endl;
+    std::cout << "starting reference " << m_referenceCount << std::endl;
 #endif
 
-    m_patternList.emplace_back(new ReferencePattern(patterns, referenceStart, referenceIndex++));
-    m_patternList.emplace_back(new AlternationPattern(patterns));
+    m_referencePatterns.emplace_back(m_patternList.size());
+    m_patternList.emplace_back(new ReferencePattern(patterns, m_referenceCount++));
+    m_patternList.emplace_back(new AlternationPattern(m_patternList.size() + 1));
   }
   else if (ReferencePattern::is_this_pattern(patterns))
   {
-    m_patternReferences.emplace_back(std::make_shared<std::string>());
-
-    std::shared_ptr<std::size_t> referenceStart = std::make_shared<std::size_t>();
-    m_referenceStarts.emplace_back(referenceStart);
-
-    m_referenceIndexs.emplace_back(referenceIndex);
+    m_referenceIndexs.emplace_back(m_referenceCount);
 
 #if DEBUGGING
-    std::cout << "starting reference " << referenceIndex << std::endl;
+    std::cout << "starting reference " << m_referenceCount << std::endl;
 #endif
 
-    m_patternList.emplace_back(new ReferencePattern(patterns, referenceStart, referenceIndex++));
+    m_referencePatterns.emplace_back(m_patternList.size());
+    m_patternList.emplace_back(new ReferencePattern(patterns, m_referenceCount++));
+  }
+  else if (AlternateMarkerPattern::is_this_pattern(patterns))
+  {
+    // the branch belongs to the innermost reference, or the whole pattern outside of one
+    std::size_t alternation = m_referencePatterns.empty() ? m_topAlternation : m_referencePatterns.back() + 1;
+    AlternationPattern* alternationPattern = dynamic_cast<AlternationPattern*>(m_patternList[alternation].get());
+
+    if (!alternationPattern)
+      throw patterns.error("Unexpected alternate marker");
+
+    m_patternList.emplace_back(new AlternateMarkerPattern(patterns));
+    alternationPattern->add_branch(m_patternList.size());
   }
   else if (EndReferencePattern::is_this_pattern(patterns))
   {
     if (m_referenceIndexs.size() <= 0)
-      throw std::runtime_error("Unexpected closing bracket");
+      throw patterns.error("Unexpected closing bracket");
 
 #if DEBUGGING
     std::cout << "ending reference " << m_referenceIndexs.back() << std::endl;
 #endif
 
-    m_patternList.emplace_back(new EndReferencePattern(patterns, m_patternReferences[m_referenceIndexs.back()], m_referenceStarts[m_referenceIndexs.back()]));
+    std::size_t start = m_referencePatterns.back();
+    static_cast<ReferencePattern*>(m_patternList[start].get())->set_end(m_patternList.size());
+    finishAlternation(start + 1, m_patternList.size());
+
+    m_patternList.emplace_back(new EndReferencePattern(patterns, m_referenceIndexs.back(), start));
     m_referenceIndexs.pop_back();
+    m_referencePatterns.pop_back();
   }
   else if (BackreferencePattern::is_this_pattern(patterns))
   {
-    m_patternList.emplace_back(new BackreferencePattern(patterns, m_patternReferences));
+    m_patternList.emplace_back(new BackreferencePattern(patterns, m_firstReference, m_referenceCount));
   }
   else if (LiteralCharacterPattern::is_this_pattern(patterns)) // needs to be last
   {
     m_patternList.emplace_back(new LiteralCharacterPattern(patterns));
   }
 
-  //check for multi pattern as these affect this pattern
-  if (OneMorePattern::is_this_pattern(patterns))
-  {
-    m_patternList.back()->one_or_more = true;
+  if (prevSize == m_patternList.size())
+    throw patternStart.error("Unhandled pattern " + std::string(1, patternStart.peek()));
+
+  // a quantifier can't follow the start of a group or branch, there it is a literal
+  PatternType lastType = m_patternList.back()->type;
+  if (lastType == PatternType::Match || lastType == PatternType::EndReference)
+    addQuantifier(patterns, *m_patternList.back());
+
 #if DEBUGGING
-    std::cout << "made pattern 1 or more" << std::endl;
+    std::cout << "Added " << m_patternList.back()->print() << std::endl;
 #endif
+}
+
+/**********************************************************************
+ * addQuantifier
+ *
+ * Description: Sets the pattern's repeat counts from the quantifier
+ *     after it, if there is one. The quantifier is removed
+ *
+ * Parameters:
+ *   patterns: string of all patterns desired, will have the quantifier
+ *       removed
+ *   pattern: the pattern the quantifier applies to
+ *********************************************************************/
+void CompiledPattern::addQuantifier(PatternCursor& patterns, Pattern& pattern)
+{
+  PatternCursor quantifierStart = patterns;
+  std::uint32_t min, max;
+
+  if (OneMorePattern::is_this_pattern(patterns))
+  {
+    pattern.min_repeat = 1;
+    pattern.max_repeat = Pattern::UNBOUNDED;
+  }
+  else if (ZeroOrMorePattern::is_this_pattern(patterns))
+  {
+    pattern.min_repeat = 0;
+    pattern.max_repeat = Pattern::UNBOUNDED;
   }
   else if (OptionalPattern::is_this_pattern(patterns))
   {
-    m_patternList.back()->optional = true;
-#if DEBUGGING
-    std::cout << "made pattern optional" << std::endl;
-#endif
+    pattern.min_repeat = 0;
+    pattern.max_repeat = 1;
+  }
+  else if (CountedRepeatPattern::is_this_pattern(patterns, min, max))
+  {
+    if (min > max)
+      throw quantifierStart.error("Repeat count minimum is more than the maximum");
 
+    pattern.min_repeat = min;
+    pattern.max_repeat = max;
+  }
+  else
+  {
+    return;
   }
 
-  if (prevSize == m_patternList.size())
-    throw std::runtime_error("Unhandled pattern " + patterns);
+  pattern.lazy = LazyPattern::is_this_pattern(patterns);
+
+  // nested counts multiply, checked here so the NFA never has to copy them out.
+  // A group that is only made optional or looped isn't copied
+  if (const EndReferencePattern* end = dynamic_cast<const EndReferencePattern*>(&pattern))
+  {
+    std::uint64_t once = unrolledSize(end->start() + 1, m_patternList.size() - 1);
+    std::uint64_t unrolled = unrolledSize(end->start(), m_patternList.size());
+
+    if (unrolled > once && unrolled > REPEAT_LIMIT)
+      throw quantifierStart.error("Repeated group unrolls to more than " + std::to_string(REPEAT_LIMIT) + " patterns");
+  }
 
 #if DEBUGGING
-    std::cout << "Added " << m_patternList.back()->print() << std::endl;
+  std::cout << "made pattern repeat " << pattern.min_repeat << " to " << pattern.max_repeat << (pattern.lazy ? " lazily" : "") << std::endl;
 #endif
+
+  PatternCursor next = patterns;
+  if (next.startsWith("+") || next.startsWith("*") || next.startsWith("?") || CountedRepeatPattern::is_this_pattern(next, min, max))
+    throw patterns.error("Multiple quantifiers in a row");
+}
+
+/**********************************************************************
+ * finishAlternation
+ *
+ * Description: Points the end of every branch at the end of the
+ *      alternation once it is known
+ *
+ * Parameters:
+ *   alternation: index of the pattern that may be an alternation
+ *   end: index of the pattern after the last branch
+ *********************************************************************/
+void CompiledPattern::finishAlternation(std::size_t alternation, std::size_t end)
+{
+  AlternationPattern* alternationPattern = dynamic_cast<AlternationPattern*>(m_patternList[alternation].get());
+
+  if (!alternationPattern)
+    return;
+
+  alternationPattern->set_end(end);
+
+  for (std::size_t branch : alternationPattern->branches())
+  {
+    if (AlternateMarkerPattern* marker = dynamic_cast<AlternateMarkerPattern*>(m_patternList[branch-1].get()))
+      marker->set_target(end);
+  }
 }
 
 /**********************************************************************
@@ -355,114 +1711,185 @@ void PatternHandler::addPatternFromPatternString(std::string& patterns)
  * Parameters:
  *   patterns: string of all patterns desired
  *********************************************************************/
-bool LiteralCharacterPattern::is_this_pattern(const std::string& patterns)
+bool LiteralCharacterPattern::is_this_pattern(const PatternCursor& patterns)
 {
-  return ::isprint(patterns[0]);
+  return ::isprint(static_cast<unsigned char>(patterns.peek()));
 }
 
-bool DigitsPattern::is_this_pattern(const std::string& patterns)
+bool DigitsPattern::is_this_pattern(const PatternCursor& patterns)
 {
-  return patterns.compare(0, 2, "\\d") == 0;
+  return patterns.startsWith("\\d");
 }
 
-bool AlphaNumPattern::is_this_pattern(const std::string& patterns)
+bool AlphaNumPattern::is_this_pattern(const PatternCursor& patterns)
 {
-  return patterns.compare(0, 2, "\\w") == 0;
+  return patterns.startsWith("\\w");
 }
 
-bool PositiveCharGroupPattern::is_this_pattern(const std::string& patterns)
+bool PositiveCharGroupPattern::is_this_pattern(const PatternCursor& patterns)
 {
-  if (patterns.compare(0, 1, "[") != 0)
+  if (!patterns.startsWith("["))
     return false;
 
-  int endPos = patterns.find("]");
-  if (endPos == std::string::npos)
-    throw std::runtime_error("Pattern missing end bracket");
+  if (patterns.rest().find(']') == std::string_view::npos)
+    throw patterns.error("Pattern missing end bracket ']'");
 
   return true;
 }
 
-bool NegativeCharGroupPattern::is_this_pattern(const std::string& patterns)
+bool NegativeCharGroupPattern::is_this_pattern(const PatternCursor& patterns)
 {
-  if (patterns.compare(0, 2, "[^") != 0)
+  if (!patterns.startsWith("[^"))
     return false;
 
-  int endPos = patterns.find("]");
-  if (endPos == std::string::npos)
-    throw std::runtime_error("Pattern missing end bracket");
+  if (patterns.rest().find(']') == std::string_view::npos)
+    throw patterns.error("Pattern missing end bracket ']'");
+
+  return true;
+}
+
+bool StartAnchorPattern::is_this_pattern(const PatternCursor& patterns)
+{
+  return patterns.startsWith("^");
+}
+
+bool EndAnchorPattern::is_this_pattern(const PatternCursor& patterns)
+{
+  return patterns.startsWith("$");
+}
+
+bool OneMorePattern::is_this_pattern(PatternCursor& patterns)
+{
+  if (!patterns.startsWith("+"))
+    return false;
 
+  patterns.advance();
   return true;
 }
 
-bool StartAnchorPattern::is_this_pattern(const std::string& patterns)
+bool OptionalPattern::is_this_pattern(PatternCursor& patterns)
 {
-  return patterns.compare(0, 1, "^") == 0;
+  if (!patterns.startsWith("?"))
+    return false;
+
+  patterns.advance();
+  return true;
 }
 
-bool EndAnchorPattern::is_this_pattern(const std::string& patterns)
+bool ZeroOrMorePattern::is_this_pattern(PatternCursor& patterns)
 {
-  return patterns.compare(0, 1, "$") == 0;
+  if (!patterns.startsWith("*"))
+    return false;
+
+  patterns.advance();
+  return true;
 }
 
-bool OneMorePattern::is_this_pattern(std::string& patterns)
+bool CountedRepeatPattern::is_this_pattern(PatternCursor& patterns, std::uint32_t& min, std::uint32_t& max)
 {
-  if (patterns.compare(0, 1, "+") != 0)
+  if (!patterns.startsWith("{"))
+    return false;
+
+  // read a count, at most REPEAT_LIMIT so the NFA copies stay bounded
+  std::size_t pos = 1;
+  auto readCount = [&patterns, &pos](std::uint32_t& count)
+  {
+    std::size_t start = pos;
+    count = 0;
+
+    while (std::isdigit(static_cast<unsigned char>(patterns.peek(pos))))
+    {
+      count = count * 10 + (patterns.peek(pos++) - '0');
+
+      if (count > REPEAT_LIMIT)
+        throw patterns.error("Repeat count is more than " + std::to_string(REPEAT_LIMIT), start);
+    }
+
+    return pos > start;
+  };
+
+  // {,n} is the same as {0,n}
+  bool haveMin = readCount(min);
+
+  max = min;
+  if (patterns.peek(pos) == ',')
+  {
+    ++pos;
+    if (!readCount(max))
+    {
+      if (!haveMin)
+        return false;
+
+      max = Pattern::UNBOUNDED;
+    }
+  }
+  else if (!haveMin)
+  {
+    return false;
+  }
+
+  if (patterns.peek(pos) != '}')
     return false;
 
-  patterns = patterns.substr(1);
+  patterns.advance(pos + 1);
   return true;
 }
 
-bool OptionalPattern::is_this_pattern(std::string& patterns)
+bool LazyPattern::is_this_pattern(PatternCursor& patterns)
 {
-  if (patterns.compare(0, 1, "?") != 0)
+  if (!patterns.startsWith("?"))
     return false;
 
-  patterns = patterns.substr(1);
+  patterns.advance();
   return true;
 }
 
-bool WildcardPattern::is_this_pattern(const std::string& patterns)
+bool WildcardPattern::is_this_pattern(const PatternCursor& patterns)
 {
-  return patterns.compare(0, 1, ".") == 0;
+  return patterns.startsWith(".");
 }
 
-bool AlternationPattern::is_this_pattern(const std::string& patterns)
+bool AlternationPattern::is_this_pattern(const PatternCursor& patterns)
 {
-  if (patterns.compare(0, 1, "(") != 0)
+  if (!patterns.startsWith("("))
     return false;
 
-  if (findAlternateMarker(0, patterns) == std::string::npos)
+  if (findAlternateMarker(1, patterns.rest()) == std::string::npos)
     return false;
 
-  if (findMatchingEndBracket(0, patterns) == std::string::npos)
-    throw std::runtime_error("Alternation pattern missing end bracket ')'");
+  if (findMatchingEndBracket(1, patterns.rest()) == std::string::npos)
+    throw patterns.error("Alternation pattern missing end bracket ')'");
 
   return true;
 }
 
-bool ReferencePattern::is_this_pattern(const std::string& patterns)
+bool AlternateMarkerPattern::is_this_pattern(const PatternCursor& patterns)
 {
-  if (patterns.compare(0, 1, "(") != 0)
+  return patterns.startsWith("|");
+}
+
+bool ReferencePattern::is_this_pattern(const PatternCursor& patterns)
+{
+  if (!patterns.startsWith("("))
     return false;
 
-  if (findMatchingEndBracket(0, patterns) == std::string::npos)
-    throw std::runtime_error("Reference pattern missing end bracket ')'");
+  if (findMatchingEndBracket(1, patterns.rest()) == std::string::npos)
+    throw patterns.error("Reference pattern missing end bracket ')'");
 
   return true;
 }
 
-bool EndReferencePattern::is_this_pattern(const std::string& patterns)
+bool EndReferencePattern::is_this_pattern(const PatternCursor& patterns)
 {
-  return patterns.compare(0, 1, ")") == 0;
+  return patterns.startsWith(")");
 }
 
-bool BackreferencePattern::is_this_pattern(const std::string& patterns)
+bool BackreferencePattern::is_this_pattern(const PatternCursor& patterns)
 {
-  if (patterns.size() < 2 || patterns.compare(0, 1, "\\") != 0)
+  if (patterns.size() < 2 || !patterns.startsWith("\\"))
     return false;
 
-  if (::isdigit(patterns[1]))
+  if (::isdigit(static_cast<unsigned char>(patterns.peek(1))))
     return true;
 
   return false;
@@ -473,514 +1900,328 @@ bool BackreferencePattern::is_this_pattern(const std::string& patterns)
  * Pattern Constructors
  *
  * Description: all constructors need to check for the pattern then
- *     remove said pattern
+ *     move the cursor past said pattern
  *
  * Parameters:
- *   patterns: string of all patterns desired, will have used pattern
- *       removed
+ *   patterns: cursor over all patterns desired, will be moved past the
+ *       used pattern
  *********************************************************************/
-LiteralCharacterPattern::LiteralCharacterPattern(std::string& patterns)
+LiteralCharacterPattern::LiteralCharacterPattern(PatternCursor& patterns)
 {
-  if (!is_this_pattern)
-    throw std::runtime_error("Attempted to create LiteralCharacterPattern without proper pattern in " + patterns);
+  if (!is_this_pattern(patterns))
+    throw patterns.error("Attempted to create LiteralCharacterPattern without proper pattern");
 
-  m_character = patterns[0];
+  m_character = patterns.peek();
 
-  patterns = patterns.substr(1);
+  patterns.advance();
 }
 
-DigitsPattern::DigitsPattern(std::string& patterns)
+DigitsPattern::DigitsPattern(PatternCursor& patterns)
 {
-  if (!is_this_pattern)
-    throw std::runtime_error("Attempted to create DigitsPattern without proper pattern in " + patterns);
-  patterns = patterns.substr(2);
+  if (!is_this_pattern(patterns))
+    throw patterns.error("Attempted to create DigitsPattern without proper pattern");
+
+  m_class = CharacterClass::digits();
+
+  patterns.advance(2);
 }
 
-AlphaNumPattern::AlphaNumPattern(std::string& patterns)
+AlphaNumPattern::AlphaNumPattern(PatternCursor& patterns)
 {
-  if (!is_this_pattern)
-    throw std::runtime_error("Attempted to create AlphaNumPattern without proper pattern in " + patterns);
-  patterns = patterns.substr(2);
+  if (!is_this_pattern(patterns))
+    throw patterns.error("Attempted to create AlphaNumPattern without proper pattern");
+
+  m_class = CharacterClass::word();
+
+  patterns.advance(2);
 }
 
-PositiveCharGroupPattern::PositiveCharGroupPattern(std::string& patterns)
+PositiveCharGroupPattern::PositiveCharGroupPattern(PatternCursor& patterns)
 {
-  if (!is_this_pattern)
-    throw std::runtime_error("Attempted to create PositiveCharGroupPattern without proper pattern in " + patterns);
+  if (!is_this_pattern(patterns))
+    throw patterns.error("Attempted to create PositiveCharGroupPattern without proper pattern");
 
-  int endPos = patterns.find("]");
+  std::size_t endPos = patterns.rest().find(']');
 
-  m_characters = patterns.substr(1, endPos-1);
+  patterns.advance();
+  PatternCursor group = patterns.take(endPos - 1);
 
-  patterns = patterns.substr(endPos+1);
+  m_characters = group.rest();
+  m_class = CharacterClass(parseCharacterGroup(group));
 
-  //std::cout << m_characters << " " << patterns << std::endl;
+  patterns.advance();
 }
 
-NegativeCharGroupPattern::NegativeCharGroupPattern(std::string& patterns)
+NegativeCharGroupPattern::NegativeCharGroupPattern(PatternCursor& patterns)
 {
-  if (!is_this_pattern)
-    throw std::runtime_error("Attempted to create NegativeCharGroupPattern without proper pattern in " + patterns);
+  if (!is_this_pattern(patterns))
+    throw patterns.error("Attempted to create NegativeCharGroupPattern without proper pattern");
 
-  int endPos = patterns.find("]");
+  std::size_t endPos = patterns.rest().find(']');
 
-  m_characters = patterns.substr(2, endPos-2);
+  patterns.advance(2);
+  PatternCursor group = patterns.take(endPos - 2);
 
-  patterns = patterns.substr(endPos+1);
+  m_characters = group.rest();
+  m_class = CharacterClass(~parseCharacterGroup(group));
 
-  //std::cout << m_characters << " " << patterns << std::endl;
+  patterns.advance();
 }
 
-StartAnchorPattern::StartAnchorPattern(std::string& patterns)
+StartAnchorPattern::StartAnchorPattern(PatternCursor& patterns)
 {
-  if (!is_this_pattern)
-    throw std::runtime_error("Attempted to create StartAnchorPattern without proper pattern in " + patterns);
-
-  forceStart = true;
+  if (!is_this_pattern(patterns))
+    throw patterns.error("Attempted to create StartAnchorPattern without proper pattern");
 
-  patterns = patterns.substr(1);
+  patterns.advance();
 }
 
-EndAnchorPattern::EndAnchorPattern(std::string& patterns)
+EndAnchorPattern::EndAnchorPattern(PatternCursor& patterns)
 {
-  if (!is_this_pattern)
-    throw std::runtime_error("Attempted to create EndAnchorPattern without proper pattern in " + patterns);
+  if (!is_this_pattern(patterns))
+    throw patterns.error("Attempted to create EndAnchorPattern without proper pattern");
 
-  patterns = patterns.substr(1);
+  patterns.advance();
 }
 
-WildcardPattern::WildcardPattern(std::string& patterns)
+WildcardPattern::WildcardPattern(PatternCursor& patterns)
 {
-  if (!is_this_pattern)
-    throw std::runtime_error("Attempted to create WildcardPattern without proper pattern in " + patterns);
+  if (!is_this_pattern(patterns))
+    throw patterns.error("Attempted to create WildcardPattern without proper pattern");
 
-  patterns = patterns.substr(1);
+  patterns.advance();
 }
 
-AlternationPattern::AlternationPattern(std::string& patterns)
+AlternationPattern::AlternationPattern(std::size_t firstBranch)
 {
-  if (!is_this_pattern)
-    throw std::runtime_error("Attempted to create AlternationPattern without proper pattern in " + patterns);
+  type = PatternType::Alternation;
 
-  std::size_t endPos = findMatchingEndBracket(0, patterns);
-  std::size_t dividerPos = findAlternateMarker(0, patterns);
-  m_option1 = patterns.substr(0, dividerPos);
-  m_option2 = patterns.substr(dividerPos+1, endPos-1-dividerPos);
-
-  // leave in closing bracket to finish adding the reference
-  patterns = patterns.substr(endPos);
+  // the branches are added to the compiled pattern as they are parsed
+  m_branches.push_back(firstBranch);
 
 #if DEBUGGING
-  std::cout << "adding alternation pattern option 1: " + m_option1 + " option 2: " + m_option2 + " leftover patterns: " + patterns << std::endl;
+  std::cout << "adding alternation pattern first branch at " << firstBranch << std::endl;
 #endif
 }
 
-ReferencePattern::ReferencePattern(std::string& patterns, const std::shared_ptr<std::size_t>& referenceStart, int index)
+AlternateMarkerPattern::AlternateMarkerPattern(PatternCursor& patterns)
+{
+  if (!is_this_pattern(patterns))
+    throw patterns.error("Attempted to create AlternateMarkerPattern without proper pattern");
+
+  type = PatternType::AlternateMarker;
+
+  patterns.advance();
+}
+
+AlternateMarkerPattern::AlternateMarkerPattern()
 {
-  if (!is_this_pattern)
-    throw std::runtime_error("Attempted to create ReferencePattern without proper pattern in " + patterns);
+  // between the patterns of a pattern set, there is no '|' in any of them
+  type = PatternType::AlternateMarker;
+}
+
+ReferencePattern::ReferencePattern(PatternCursor& patterns, int index)
+{
+  if (!is_this_pattern(patterns))
+    throw patterns.error("Attempted to create ReferencePattern without proper pattern");
 
+  type = PatternType::Reference;
   m_index = index;
-  m_referenceStart = referenceStart;
 
-  patterns = patterns.substr(1);
+  patterns.advance();
 
 #if DEBUGGING
   std::cout << "adding reference pattern " << m_index << std::endl;
 #endif
 }
 
-EndReferencePattern::EndReferencePattern(std::string& patterns, const std::shared_ptr<std::string>& referencePattern, const std::shared_ptr<std::size_t>& referenceStart)
+EndReferencePattern::EndReferencePattern(PatternCursor& patterns, int index, std::size_t start)
 {
-  if (!is_this_pattern)
-    throw std::runtime_error("Attempted to create EndReferencePattern without proper pattern in " + patterns);
+  if (!is_this_pattern(patterns))
+    throw patterns.error("Attempted to create EndReferencePattern without proper pattern");
 
-  m_referencePattern = referencePattern;
-  m_referenceStart = referenceStart;
+  type = PatternType::EndReference;
+  m_index = index;
+  m_start = start;
 
-  patterns = patterns.substr(1);
+  patterns.advance();
 
 #if DEBUGGING
   std::cout << "adding end of reference pattern" << std::endl;
 #endif
 }
 
-BackreferencePattern::BackreferencePattern(std::string& patterns, const std::vector<std::shared_ptr<std::string>>& referencedPatterns)
+BackreferencePattern::BackreferencePattern(PatternCursor& patterns, std::size_t firstReference, std::size_t referenceCount)
 {
-  if (!is_this_pattern)
-    throw std::runtime_error("Attempted to create BackreferencePattern without proper pattern in " + patterns);
+  if (!is_this_pattern(patterns))
+    throw patterns.error("Attempted to create BackreferencePattern without proper pattern");
 
-  m_index = patterns[1] - '0' - 1;
+  // in a pattern set \1 is the first group of this pattern, not of the whole set, \0 wraps round past every group
+  std::size_t index = firstReference + patterns.peek(1) - '0' - 1;
 #if DEBUGGING
-  std::cout << "creating backreference with from " + patterns.substr(1, 1) + " to get index " << m_index << std::endl;
+  std::cout << "creating backreference with from " << patterns.peek(1) << " to get index " << index << std::endl;
 #endif
 
-  if (m_index >= referencedPatterns.size())
-    throw std::runtime_error("Attempted to create BackreferencePattern to an undeclared pattern");
+  if (index < firstReference || index >= referenceCount)
+    throw patterns.error("Attempted to create BackreferencePattern to an undeclared pattern");
 
-  m_referencedPattern = referencedPatterns.at(m_index);
+  m_index = static_cast<int>(index);
 
-  patterns = patterns.substr(2);
+  patterns.advance(2);
 }
 
 /**********************************************************************
- * Pattern find_first_of
+ * Pattern add_to_nfa
  *
- * Description: Finds the end position of the first substring that
- *     matches the pattern
+ * Description: Adds the states for this pattern to the NFA, ignoring
+ *     any quantifiers which are added by the caller
  *
  * Parameters:
- *   pos: which position to start at
- *   input: the string to search for the pattern
+ *   nfa: the NFA to add the states to
  *
- * Returns: the position after the final character of the pattern in
- *      the input string, npos if not found
+ * Returns: the fragment matching this pattern
  *********************************************************************/
-std::size_t LiteralCharacterPattern::find_first_of(std::size_t pos, const std::string& input)
+Nfa::Fragment LiteralCharacterPattern::add_to_nfa(Nfa& nfa) const
 {
-  std::size_t newPos;
+  CharacterSet characters;
+  characters.set(static_cast<unsigned char>(m_character));
 
-#if DEBUGGING
-  std::cout << "first checking at pos " << pos  << " and beyond from " << input << " looking for " << m_character << " found at " << input.find(m_character, pos) << std::endl;
-#endif
-  if ((newPos = input.find_first_of(m_character, pos)) != std::string::npos)
-  {
-#if DEBUGGING
-    std::cout << "first found at pos " << newPos  << " character " << input[newPos] << " from " << input << " looking for " << m_character << std::endl;
-#endif
-    return newPos + 1;
-  }
-
-  return std::string::npos;
+  return nfa.character(characters);
 }
 
-std::size_t DigitsPattern::find_first_of(std::size_t pos, const std::string& input)
+Nfa::Fragment DigitsPattern::add_to_nfa(Nfa& nfa) const
 {
-  std::size_t newPos;
-
-  if (auto it = std::find_if(input.begin(), input.end(), ::isdigit); it != input.end())
-    return distance(input.begin() + pos, it) + 1;
-
-  return std::string::npos;
+  return nfa.character(m_class.characters());
 }
 
-std::size_t AlphaNumPattern::find_first_of(std::size_t pos, const std::string& input)
+Nfa::Fragment AlphaNumPattern::add_to_nfa(Nfa& nfa) const
 {
-  std::size_t newPos;
-
-  if (auto it = std::find_if(input.begin(), input.end(), ::isalnum); it != input.end())
-    return distance(input.begin() + pos, it) + 1;
-
-  return std::string::npos;
+  return nfa.character(m_class.characters());
 }
 
-std::size_t PositiveCharGroupPattern::find_first_of(std::size_t pos, const std::string& input)
+Nfa::Fragment PositiveCharGroupPattern::add_to_nfa(Nfa& nfa) const
 {
-  std::size_t newPos;
-
-  if ((newPos = input.find_first_of(m_characters, pos)) != std::string::npos)
-    return newPos + 1;
-
-  return std::string::npos;
+  return nfa.character(m_class.characters());
 }
 
-std::size_t NegativeCharGroupPattern::find_first_of(std::size_t pos, const std::string& input)
+Nfa::Fragment NegativeCharGroupPattern::add_to_nfa(Nfa& nfa) const
 {
-  std::size_t newPos;
-
-  if ((newPos = input.find_first_not_of(m_characters, pos)) != std::string::npos)
-    return newPos + 1;
-
-  return std::string::npos;
+  return nfa.character(m_class.characters());
 }
 
-std::size_t StartAnchorPattern::find_first_of(std::size_t pos, const std::string& input)
+Nfa::Fragment StartAnchorPattern::add_to_nfa(Nfa& nfa) const
 {
-  if (pos != 0)
-    return std::string::npos;
-
-  return 0;
+  return nfa.assertStart();
 }
 
-std::size_t EndAnchorPattern::find_first_of(std::size_t pos, const std::string& input)
+Nfa::Fragment EndAnchorPattern::add_to_nfa(Nfa& nfa) const
 {
-  return input.size();
+  return nfa.assertEnd();
 }
 
-std::size_t WildcardPattern::find_first_of(std::size_t pos, const std::string& input)
+Nfa::Fragment WildcardPattern::add_to_nfa(Nfa& nfa) const
 {
-  if (pos >= input.size())
-    return std::string::npos;
-
-  return pos + 1;
+  return nfa.character(~CharacterSet());
 }
 
-std::size_t AlternationPattern::find_first_of(std::size_t pos, const std::string& input)
+Nfa::Fragment AlternationPattern::add_to_nfa(Nfa& nfa) const
 {
-#if DEBUGGING
-  std::cout << "first entering option 1 with input " << input.substr(pos) << " patterns " << m_option1 << std::endl;
-#endif
-
-  // check if the first option succeeds
-  std::size_t result = PatternHandler(input.substr(pos), m_option1, false);
-
-#if DEBUGGING
-  std::cout << "first leaving option 1 with input " << input.substr(pos) << " patterns " << m_option1 << " result " << result << std::endl;
-#endif
-
-  // first option succeeded and result is relative to pos
-  if (result != std::string::npos)
-    return result+pos;
-
-#if DEBUGGING
-  std::cout << "first entering option 2 with input " << input.substr(pos) << " patterns " << m_option2 << std::endl;
-#endif
-  // check if the second option succeeds
-  result = PatternHandler(input.substr(pos), m_option2, false);
-
-#if DEBUGGING
-  std::cout << "first leaving option 2 with input " << input.substr(pos) << " patterns " << m_option2 << " result " << result << std::endl;
-#endif
-
-  // second option succeeded and result is relative to pos
-  if (result != std::string::npos)
-    return result+pos;
-
-  return result;
+  throw std::runtime_error("Alternation pattern branches are added to an NFA by the compiled pattern");
 }
 
-std::size_t ReferencePattern::find_first_of(std::size_t pos, const std::string& input)
+Nfa::Fragment AlternateMarkerPattern::add_to_nfa(Nfa& nfa) const
 {
-  if (m_referenceStart.expired())
-    throw std::runtime_error("Attempted to access expired memory");
-
-  std::shared_ptr<std::size_t> referenceStart = m_referenceStart.lock();
-  *referenceStart = pos;
-
-#if DEBUGGING
-  std::cout << "first reference pattern " << m_index << " started at " << pos << " " + input.substr(pos) << std::endl;
-#endif
-
-  return pos;
+  throw std::runtime_error("Alternate marker pattern branches are added to an NFA by the compiled pattern");
 }
 
-std::size_t EndReferencePattern::find_first_of(std::size_t pos, const std::string& input)
+Nfa::Fragment ReferencePattern::add_to_nfa(Nfa& nfa) const
 {
-  if (m_referencePattern.expired())
-    throw std::runtime_error("Attempted to access expired memory");
-
-  if (m_referenceStart.expired())
-    throw std::runtime_error("Attempted to access expired memory");
-
-  std::shared_ptr<std::size_t> referenceStart = m_referenceStart.lock();
-  std::shared_ptr<std::string> referencePattern = m_referencePattern.lock();
-
-#if DEBUGGING
-  std::cout << "first found reference that started at " << *referenceStart << " ended at " << pos << std::endl;
-#endif
-
-  // save the input that matched
-  *referencePattern = input.substr(*referenceStart, pos - *referenceStart);
-
-#if DEBUGGING
-  std::cout << "first found reference to check later: " + *referencePattern + " started at " << *referencePattern << " ended at " << pos << std::endl;
-#endif
-
-  return pos;
+  return nfa.empty();
 }
 
-std::size_t BackreferencePattern::find_first_of(std::size_t pos, const std::string& input)
+Nfa::Fragment EndReferencePattern::add_to_nfa(Nfa& nfa) const
 {
-  if (m_referencedPattern.expired())
-    throw std::runtime_error("Attempted to access expired memory");
-
-  std::shared_ptr<std::string> referencedPattern = m_referencedPattern.lock();
-
-  std::size_t newPos;
-
-#if DEBUGGING
-  std::cout << "first checking at pos " << pos  << " and beyond from " << input << " looking for " << *referencedPattern << " found at " << input.find_first_of(*referencedPattern, pos) << std::endl;
-#endif
-  if ((newPos = input.find_first_of(*referencedPattern, pos)) != std::string::npos)
-  {
-#if DEBUGGING
-    std::cout << "first found at pos " << newPos  << " string " << *referencedPattern << " from " << input << " leftovers " << input.substr(newPos + referencedPattern->size()) << std::endl;
-#endif
-    return newPos + referencedPattern->size();
-  }
+  return nfa.empty();
+}
 
-  return std::string::npos;
+Nfa::Fragment BackreferencePattern::add_to_nfa(Nfa& nfa) const
+{
+  throw std::runtime_error("Backreference pattern can't be added to an NFA");
 }
 
 /**********************************************************************
-* Pattern starts_with
-*
-* Description: checks if the input string at pos starts with the
-*     pattern
-*
-* Parameters:
-*   pos: which position to start at
-*   input: the string to check for the pattern
-*
-* Returns: the position after the final character of the pattern in
-*     the input string, npos if it doesn't start with the pattern
-*
-* Note: this is similar to find_first_of however doesn't check the
-*     whole string just the start of (at given pos) and can therefore
-*     be faster
-**********************************************************************/
-std::size_t LiteralCharacterPattern::starts_with(std::size_t pos, const std::string& input)
+ * Pattern to_instruction
+ *
+ * Description: Turns this pattern into its backtracking instruction,
+ *     any quantifiers are added by the caller
+ *
+ * Parameters:
+ *   program: the program the instruction will be added to, for the
+ *       tables it refers to
+ *
+ * Returns: the instruction for this pattern
+ *********************************************************************/
+Instruction LiteralCharacterPattern::to_instruction(Program& program) const
 {
-#if DEBUGGING
-  std::cout << "starts  Comparing at pos " << pos << " " << input[pos] << " " << m_character << std::endl;
-#endif
-
-  if (input[pos] == m_character)
-    return pos + 1;
-
-  return std::string::npos;
+  return {.op = OpCode::Character, .character = m_character};
 }
 
-std::size_t DigitsPattern::starts_with(std::size_t pos, const std::string& input)
+Instruction DigitsPattern::to_instruction(Program& program) const
 {
-  if (::isdigit(input[pos]))
-    return pos + 1;
-
-  return std::string::npos;
+  return {.op = OpCode::Class, .argument = program.addClass(m_class)};
 }
 
-std::size_t AlphaNumPattern::starts_with(std::size_t pos, const std::string& input)
+Instruction AlphaNumPattern::to_instruction(Program& program) const
 {
-  if (::isalnum(input[pos]))
-    return pos + 1;
-
-  return std::string::npos;
+  return {.op = OpCode::Class, .argument = program.addClass(m_class)};
 }
 
-std::size_t PositiveCharGroupPattern::starts_with(std::size_t pos, const std::string& input)
+Instruction PositiveCharGroupPattern::to_instruction(Program& program) const
 {
-  if (m_characters.find_first_of(input[pos]) != std::string::npos)
-    return pos + 1;
-
-  return std::string::npos;
+  return {.op = OpCode::Class, .argument = program.addClass(m_class)};
 }
 
-std::size_t NegativeCharGroupPattern::starts_with(std::size_t pos, const std::string& input)
+Instruction NegativeCharGroupPattern::to_instruction(Program& program) const
 {
-  if (m_characters.find_first_of(input[pos]) == std::string::npos)
-    return pos + 1;
-
-  return std::string::npos;
+  return {.op = OpCode::Class, .argument = program.addClass(m_class)};
 }
 
-std::size_t StartAnchorPattern::starts_with(std::size_t pos, const std::string& input)
+Instruction StartAnchorPattern::to_instruction(Program& program) const
 {
-  throw std::runtime_error("Start of string anchor must be the first character");
+  return {.op = OpCode::AssertStart};
 }
 
-std::size_t EndAnchorPattern::starts_with(std::size_t pos, const std::string& input)
+Instruction EndAnchorPattern::to_instruction(Program& program) const
 {
-  if (pos != input.size())
-    return std::string::npos;
-
-  return input.size();
+  return {.op = OpCode::AssertEnd};
 }
 
-std::size_t WildcardPattern::starts_with(std::size_t pos, const std::string& input)
+Instruction WildcardPattern::to_instruction(Program& program) const
 {
-  if (pos >= input.size())
-    return std::string::npos;
-
-  return pos + 1;
+  return {.op = OpCode::Any};
 }
 
-std::size_t AlternationPattern::starts_with(std::size_t pos, const std::string& input)
+Instruction AlternationPattern::to_instruction(Program& program) const
 {
-#if DEBUGGING
-  std::cout << "starts  entering option 1 with input " << input.substr(pos) << " patterns " << m_option1 << std::endl;
-#endif
-
-  // check if the first option succeeds
-  std::size_t result = PatternHandler(input.substr(pos), m_option1, true);
-
-#if DEBUGGING
-  std::cout << "starts  leaving option 1 with input " << input.substr(pos) << " patterns " << m_option1 << " result " << result << std::endl;
-#endif
-
-  // first option succeeded and result is relative to pos
-  if (result != std::string::npos)
-    return result+pos;
-
-#if DEBUGGING
-  std::cout << "starts  entering option 2 with input " << input.substr(pos) << " patterns " << m_option2 << std::endl;
-#endif
-  // check if the second option succeeds
-  result = PatternHandler(input.substr(pos), m_option2, true);
-
-#if DEBUGGING
-  std::cout << "starts  leaving option 2 with input " << input.substr(pos) << " patterns " << m_option2 << " result " << result << std::endl;
-#endif
-
-  // second option succeeded and result is relative to pos
-  if (result != std::string::npos)
-    return result+pos;
-
-  return result;
+  return {.op = OpCode::Alternation, .argument = program.addBranches(m_branches), .extra = static_cast<std::uint32_t>(m_branches.size())};
 }
 
-std::size_t ReferencePattern::starts_with(std::size_t pos, const std::string& input)
+Instruction AlternateMarkerPattern::to_instruction(Program& program) const
 {
-  if (m_referenceStart.expired())
-    throw std::runtime_error("Attempted to access expired memory");
-
-  std::shared_ptr<std::size_t> referenceStart = m_referenceStart.lock();
-
-  *referenceStart = pos;
-
-#if DEBUGGING
-  std::cout << "starts  reference pattern " << m_index << " started at " << pos << " " + input.substr(pos) << std::endl;
-#endif
-
-  return pos;
+  return {.op = OpCode::AlternateMarker, .argument = static_cast<std::uint32_t>(m_target)};
 }
 
-std::size_t EndReferencePattern::starts_with(std::size_t pos, const std::string& input)
+Instruction ReferencePattern::to_instruction(Program& program) const
 {
-  if (m_referencePattern.expired())
-    throw std::runtime_error("Attempted to access expired memory");
-
-  if (m_referenceStart.expired())
-    throw std::runtime_error("Attempted to access expired memory");
-
-  std::shared_ptr<std::size_t> referenceStart = m_referenceStart.lock();
-  std::shared_ptr<std::string> referencePattern = m_referencePattern.lock();
-
-#if DEBUGGING
-  std::cout << "starts  found reference that started at " << *referenceStart << " ended at " << pos << std::endl;
-#endif
-
-  // save the input that matched
-  *referencePattern = input.substr(*referenceStart, pos - *referenceStart);
-
-#if DEBUGGING
-  std::cout << "starts  found reference to check later: " + *referencePattern + " started at " << *referenceStart << " ended at " << pos << std::endl;
-#endif
-
-  return pos;
+  return {.op = OpCode::Reference, .argument = static_cast<std::uint32_t>(m_index), .extra = static_cast<std::uint32_t>(m_end)};
 }
 
-std::size_t BackreferencePattern::starts_with(std::size_t pos, const std::string& input)
+Instruction EndReferencePattern::to_instruction(Program& program) const
 {
-  if (m_referencedPattern.expired())
-    throw std::runtime_error("Attempted to access expired memory");
-
-  std::shared_ptr<std::string> referencedPattern = m_referencedPattern.lock();
-
-#if DEBUGGING
-  std::cout << "starts  comparing " << input.substr(pos, referencedPattern->size()) << " to " << *referencedPattern << std::endl;
-#endif
-  if (input.compare(pos, referencedPattern->size(), *referencedPattern) == 0)
-    return pos + referencedPattern->size();
+  return {.op = OpCode::EndReference, .argument = static_cast<std::uint32_t>(m_index), .extra = static_cast<std::uint32_t>(m_start)};
+}
 
-  return std::string::npos;
+Instruction BackreferencePattern::to_instruction(Program& program) const
+{
+  return {.op = OpCode::Backreference, .argument = static_cast<std::uint32_t>(m_index)};
 }
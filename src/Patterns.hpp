@@ -1,54 +1,200 @@
+#pragma once
+
+#include "AhoCorasick.hpp"
+#include "Nfa.hpp"
+#include "PatternCursor.hpp"
+#include "Prefilter.hpp"
+#include "Program.hpp"
+
+#include <cstdint>
+#include <limits>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
+class CacheReader;
+class CacheWriter;
+
+// the patterns that change which pattern the backtracker tries next
+enum class PatternType
+{
+  Match,           // matches input and moves on to the next pattern
+  Alternation,
+  AlternateMarker,
+  Reference,
+  EndReference
+};
+
 class Pattern
 {
   public:
     Pattern() = default;
+    virtual ~Pattern() = default;
+
+    virtual Nfa::Fragment add_to_nfa(Nfa& nfa) const = 0;
+    virtual Instruction to_instruction(Program& program) const = 0;
+    virtual bool needs_backtracking() const { return false; };
 
-    virtual std::size_t find_first_of(std::size_t pos, const std::string& input) = 0;
-    virtual std::size_t starts_with(std::size_t pos, const std::string& input) = 0;
+    virtual std::string print() const { return std::string(); };
+
+    bool is_optional() const { return min_repeat == 0; };
+    bool can_repeat() const { return max_repeat > 1; };
+
+    static constexpr std::uint32_t UNBOUNDED = std::numeric_limits<std::uint32_t>::max();
+
+    // the quantifier after the pattern, exactly once without one
+    std::uint32_t min_repeat = 1;
+    std::uint32_t max_repeat = 1;
+    bool lazy = false;
+    PatternType type = PatternType::Match;
+};
+
+class CompiledPattern
+{
+  public:
+    CompiledPattern(const std::string& patterns);
+    CompiledPattern(const PatternCursor& patterns);
+    CompiledPattern(const std::vector<std::string>& patternSet);
+    CompiledPattern(CacheReader& reader);
+    ~CompiledPattern() = default;
+
+    void save(CacheWriter& writer) const;
+    bool cacheable() const { return m_nfa != nullptr; };
+
+    std::size_t match(std::string_view input, bool startsWith = false) const;
+    bool matches(std::string_view input, bool prefilterFound = false) const;
+    void matchingPatterns(std::string_view input, std::vector<std::size_t>& patterns) const;
+    std::size_t find(std::string_view input, std::size_t from, std::size_t& start, MatchState& state) const;
+    std::size_t groupCount() const { return m_referenceCount; };
+
+    Nfa::Fragment addToNfa(Nfa& nfa) const;
+    bool needsBacktracking() const;
+    std::string requiredLiteral() const;
+    std::vector<std::string> literalAlternation() const;
+
+    const Nfa* nfa() const { return m_nfa.get(); };
+    const LiteralPrefilter* prefilter() const { return m_prefilter.get(); };
+    const AhoCorasick* keywords() const { return m_keywords.get(); };
+    const AhoCorasick* setLiterals() const { return m_unindexedPatterns.empty() ? m_setLiterals.get() : nullptr; };
+    bool isPatternSet() const { return m_patternSet; };
+
+#if GREP_STATS
+    void writeStats(JsonWriter& json) const;
+
+    // for a search that finds a filter's literals across many lines at once
+    FilterStats& prefilterStats() const { return m_prefilterStats; };
+    FilterStats& keywordStats() const { return m_keywordStats; };
+    FilterStats& setLiteralStats() const { return m_setLiteralStats; };
+#endif
 
-    virtual std::string print() { return std::string(); };
+  private:
+    void addPatterns(const PatternCursor& patterns);
+    void addPatternFromPatternString(PatternCursor& patterns);
+    void addQuantifier(PatternCursor& patterns, Pattern& pattern);
+    void build();
+    void finishAlternation(std::size_t alternation, std::size_t end);
+    void indexPatternSet();
+    void analyseAnchors();
+    bool anchorsRuleOut(std::string_view input) const;
+    bool literalsRuleOut(std::string_view input, bool prefilterFound = false) const;
+    void analyseSuffix();
+    bool matchesSuffix(std::string_view input, std::size_t from) const;
+    const Nfa& patternNfa(std::size_t pattern) const;
+    std::string requiredLiteral(std::size_t first, std::size_t last) const;
+    std::vector<std::string> requiredLiterals(std::size_t first, std::size_t last) const;
+    Nfa::Fragment addToNfa(Nfa& nfa, std::size_t first, std::size_t last, bool reverse = false) const;
+    Nfa::Fragment addOnceToNfa(Nfa& nfa, std::size_t first, bool reverse = false) const;
+    Nfa::Fragment addRepeatToNfa(Nfa& nfa, std::size_t first, const Pattern& quantified, bool reverse = false) const;
+    std::uint64_t unrolledSize(std::size_t first, std::size_t last) const;
 
-    bool one_or_more = false;
-    bool optional = false;
-    bool forceStart = false;
+    std::vector<std::unique_ptr<Pattern>> m_patternList;
+    std::unique_ptr<Nfa> m_nfa;
+    Program m_program;
+    std::unique_ptr<LiteralPrefilter> m_prefilter;
+    std::unique_ptr<AhoCorasick> m_keywords;
+
+    // what the anchors of a single pattern say about every match, the ends
+    // of the input are checked before searching it
+    bool m_startAnchored = false; // a match can only start at the start of the input
+    std::string m_anchoredPrefix; // the literal right after a leading '^'
+    std::string m_anchoredSuffix; // the literal right before a trailing '$'
+
+    // a pattern ending in a literal is searched for by finding the literal
+    // and matching the rest of the pattern backwards from it
+    std::unique_ptr<LiteralPrefilter> m_suffix;
+    std::unique_ptr<Nfa> m_reverseNfa; // the pattern before the suffix reversed, after a '^'
+    bool m_suffixAtEnd = false;        // the suffix is followed by a '$'
+
+    // a pattern set's patterns indexed by the literals they need, a line
+    // only has to be matched against the patterns whose literals it holds
+    std::unique_ptr<AhoCorasick> m_setLiterals;
+    std::vector<std::uint32_t> m_literalStarts;     // literal n's patterns are from m_literalStarts[n] to m_literalStarts[n+1]
+    std::vector<std::uint32_t> m_literalPatterns;   // the patterns needing each literal, one literal after another
+    std::vector<std::uint32_t> m_unindexedPatterns; // patterns without a literal, always matched
+
+    // each pattern's NFA on its own, copied out of m_nfa when first needed
+    mutable std::vector<std::unique_ptr<Nfa>> m_patternNfas;
+    std::unique_ptr<std::once_flag[]> m_patternNfasSplit;
+
+    std::size_t m_referenceCount = 0;
+    std::vector<int> m_referenceIndexs;
+    std::vector<std::size_t> m_referencePatterns;
+
+    // a pattern set is one alternation at index 0 with a branch per pattern
+    bool m_patternSet = false;
+    std::size_t m_topAlternation = 0;  // alternation for a '|' outside of any reference
+    std::size_t m_firstReference = 0;  // backreference numbering restarts for each pattern
+
+    // only the automata are cached so there is no program, which an empty
+    // pattern doesn't have either
+    bool m_loadedFromCache = false;
+
+#if GREP_STATS
+    // what --stats reports about the prefilters, the automata and the
+    // program count their own work
+    mutable FilterStats m_anchorStats;
+    mutable FilterStats m_prefilterStats;
+    mutable FilterStats m_keywordStats;
+    mutable FilterStats m_setLiteralStats;
+    mutable FilterStats m_suffixStats;
+    mutable StatsCounter m_candidatesRun; // set patterns matched on their own
+#endif
 };
 
 class PatternHandler
 {
   public:
+    PatternHandler(const std::string& patterns);
     PatternHandler(const std::string& input, const std::string& patterns, bool startsWith = false);
     ~PatternHandler() = default;
 
+    std::size_t match(std::string_view input, bool startsWith = false);
+
     operator std::size_t() const { return m_result; };
     operator bool() const { return m_result != std::string::npos; };
 
   private:
-    std::size_t findPatterns(const std::string& input, std::size_t pos, int pattern, bool startsWith);
-    void addPatternFromPatternString(std::string& patterns);
-
-    std::size_t m_result = false;
-    std::vector<std::unique_ptr<Pattern>> m_patternList;
-    std::vector<std::shared_ptr<std::string>> m_patternReferences;
-    std::vector<std::shared_ptr<std::size_t>> m_referenceStarts;
-    std::vector<int> m_referenceIndexs;
+    CompiledPattern m_compiled;
+    std::size_t m_result = std::string::npos;
 };
 
 class LiteralCharacterPattern : public Pattern
 {
   public:
-    LiteralCharacterPattern(std::string& patterns);
+    LiteralCharacterPattern(PatternCursor& patterns);
     ~LiteralCharacterPattern() = default;
 
-    std::size_t find_first_of(std::size_t pos, const std::string& input);
-    std::size_t starts_with(std::size_t pos, const std::string& input);
+    Nfa::Fragment add_to_nfa(Nfa& nfa) const;
+    Instruction to_instruction(Program& program) const;
 
-    std::string print() {return std::string("Character Pattern ") + std::string(1, m_character);};
+    std::string print() const {return std::string("Character Pattern ") + std::string(1, m_character);};
 
-    static bool is_this_pattern(const std::string& patterns);
+    char character() const { return m_character; };
+
+    static bool is_this_pattern(const PatternCursor& patterns);
 
   private:
     char m_character = 0;
@@ -57,186 +203,257 @@ class LiteralCharacterPattern : public Pattern
 class DigitsPattern : public Pattern
 {
   public:
-    DigitsPattern(std::string& patterns);
+    DigitsPattern(PatternCursor& patterns);
     ~DigitsPattern() = default;
 
-    std::size_t find_first_of(std::size_t pos, const std::string& input);
-    std::size_t starts_with(std::size_t pos, const std::string& input);
+    Nfa::Fragment add_to_nfa(Nfa& nfa) const;
+    Instruction to_instruction(Program& program) const;
+
+    std::string print() const {return std::string("Digit Pattern");};
 
-    std::string print() {return std::string("Digit Pattern");};
+    static bool is_this_pattern(const PatternCursor& patterns);
 
-    static bool is_this_pattern(const std::string& patterns);
+  private:
+    CharacterClass m_class;
 };
 
 class AlphaNumPattern : public Pattern
 {
   public:
-    AlphaNumPattern(std::string& patterns);
+    AlphaNumPattern(PatternCursor& patterns);
     ~AlphaNumPattern() = default;
 
-    std::size_t find_first_of(std::size_t pos, const std::string& input);
-    std::size_t starts_with(std::size_t pos, const std::string& input);
+    Nfa::Fragment add_to_nfa(Nfa& nfa) const;
+    Instruction to_instruction(Program& program) const;
+
+    std::string print() const {return std::string("AlphaNum Pattern");};
 
-    std::string print() {return std::string("AlphaNum Pattern");};
+    static bool is_this_pattern(const PatternCursor& patterns);
 
-    static bool is_this_pattern(const std::string& patterns);
+  private:
+    CharacterClass m_class;
 };
 
 class PositiveCharGroupPattern : public Pattern
 {
   public:
-    PositiveCharGroupPattern(std::string& patterns);
+    PositiveCharGroupPattern(PatternCursor& patterns);
     ~PositiveCharGroupPattern() = default;
 
-    std::size_t find_first_of(std::size_t pos, const std::string& input);
-    std::size_t starts_with(std::size_t pos, const std::string& input);
+    Nfa::Fragment add_to_nfa(Nfa& nfa) const;
+    Instruction to_instruction(Program& program) const;
 
-    std::string print() {return std::string("Positive Character Group Pattern ") + m_characters;};
+    std::string print() const {return std::string("Positive Character Group Pattern ") + m_characters;};
 
-    static bool is_this_pattern(const std::string& patterns);
+    static bool is_this_pattern(const PatternCursor& patterns);
 
   private:
     std::string m_characters = "";
+    CharacterClass m_class;
 };
 
 class NegativeCharGroupPattern : public Pattern
 {
   public:
-    NegativeCharGroupPattern(std::string& patterns);
+    NegativeCharGroupPattern(PatternCursor& patterns);
     ~NegativeCharGroupPattern() = default;
 
-    std::size_t find_first_of(std::size_t pos, const std::string& input);
-    std::size_t starts_with(std::size_t pos, const std::string& input);
+    Nfa::Fragment add_to_nfa(Nfa& nfa) const;
+    Instruction to_instruction(Program& program) const;
 
-    std::string print() {return std::string("Negative Character Group Pattern ") + m_characters;};
+    std::string print() const {return std::string("Negative Character Group Pattern ") + m_characters;};
 
-    static bool is_this_pattern(const std::string& patterns);
+    static bool is_this_pattern(const PatternCursor& patterns);
 
   private:
     std::string m_characters = "";
+    CharacterClass m_class;
 };
 
 class StartAnchorPattern : public Pattern
 {
   public:
-    StartAnchorPattern(std::string& patterns);
+    StartAnchorPattern(PatternCursor& patterns);
     ~StartAnchorPattern() = default;
 
-    std::size_t find_first_of(std::size_t pos, const std::string& input);
-    std::size_t starts_with(std::size_t pos, const std::string& input);
+    Nfa::Fragment add_to_nfa(Nfa& nfa) const;
+    Instruction to_instruction(Program& program) const;
 
-    std::string print() {return std::string("Start Anchor Pattern");};
+    std::string print() const {return std::string("Start Anchor Pattern");};
 
-    static bool is_this_pattern(const std::string& patterns);
+    static bool is_this_pattern(const PatternCursor& patterns);
 };
 
 class EndAnchorPattern : public Pattern
 {
   public:
-    EndAnchorPattern(std::string& patterns);
+    EndAnchorPattern(PatternCursor& patterns);
     ~EndAnchorPattern() = default;
 
-    std::size_t find_first_of(std::size_t pos, const std::string& input);
-    std::size_t starts_with(std::size_t pos, const std::string& input);
+    Nfa::Fragment add_to_nfa(Nfa& nfa) const;
+    Instruction to_instruction(Program& program) const;
 
-    std::string print() {return std::string("End Anchor Pattern");};
+    std::string print() const {return std::string("End Anchor Pattern");};
 
-    static bool is_this_pattern(const std::string& patterns);
+    static bool is_this_pattern(const PatternCursor& patterns);
 };
 
 class OneMorePattern
 {
   public:
-    static bool is_this_pattern(std::string& patterns);
+    static bool is_this_pattern(PatternCursor& patterns);
 };
 
 class OptionalPattern
 {
   public:
-    static bool is_this_pattern(std::string& patterns);
+    static bool is_this_pattern(PatternCursor& patterns);
+};
+
+class ZeroOrMorePattern
+{
+  public:
+    static bool is_this_pattern(PatternCursor& patterns);
+};
+
+// {m}, {m,} or {m,n}, a '{' that doesn't start one of these is a literal
+class CountedRepeatPattern
+{
+  public:
+    static bool is_this_pattern(PatternCursor& patterns, std::uint32_t& min, std::uint32_t& max);
+};
+
+// a '?' after a quantifier makes it match as few times as it can
+class LazyPattern
+{
+  public:
+    static bool is_this_pattern(PatternCursor& patterns);
 };
 
 class WildcardPattern : public Pattern
 {
   public:
-    WildcardPattern(std::string& patterns);
+    WildcardPattern(PatternCursor& patterns);
     ~WildcardPattern() = default;
 
-    std::size_t find_first_of(std::size_t pos, const std::string& input);
-    std::size_t starts_with(std::size_t pos, const std::string& input);
+    Nfa::Fragment add_to_nfa(Nfa& nfa) const;
+    Instruction to_instruction(Program& program) const;
 
-    std::string print() {return std::string("Wild Card Pattern");};
+    std::string print() const {return std::string("Wild Card Pattern");};
 
-    static bool is_this_pattern(const std::string& patterns);
+    static bool is_this_pattern(const PatternCursor& patterns);
 };
 
+// the start of an alternation, the branches follow it in the same pattern
+// list and each one but the last ends with an AlternateMarkerPattern
 class AlternationPattern : public Pattern
 {
   public:
-    AlternationPattern(std::string& patterns);
+    AlternationPattern(std::size_t firstBranch);
     ~AlternationPattern() = default;
 
-    std::size_t find_first_of(std::size_t pos, const std::string& input);
-    std::size_t starts_with(std::size_t pos, const std::string& input);
+    Nfa::Fragment add_to_nfa(Nfa& nfa) const;
+    Instruction to_instruction(Program& program) const;
+
+    std::string print() const {return std::string("Alternation Pattern with " + std::to_string(m_branches.size()) + " branches");};
+
+    void add_branch(std::size_t branch) { m_branches.push_back(branch); };
+    void set_end(std::size_t end) { m_end = end; };
+
+    const std::vector<std::size_t>& branches() const { return m_branches; };
+    std::size_t end() const { return m_end; };
+
+    // index one past the last pattern of the branch, before its marker
+    std::size_t branch_end(std::size_t branch) const { return branch + 1 < m_branches.size() ? m_branches[branch+1] - 1 : m_end; };
 
-    std::string print() {return std::string("Alternative Pattern Option 1: " + m_option1 + " Option 2: " + m_option2);};
+    static bool is_this_pattern(const PatternCursor& patterns);
 
-    static bool is_this_pattern(const std::string& patterns);
+  private:
+    std::vector<std::size_t> m_branches; // index of the first pattern in each branch
+    std::size_t m_end = 0;               // index of the closing bracket, or the list size at the top level
+};
+
+// the '|' between two branches, reaching it means the branch matched
+class AlternateMarkerPattern : public Pattern
+{
+  public:
+    AlternateMarkerPattern(PatternCursor& patterns);
+    AlternateMarkerPattern();
+    ~AlternateMarkerPattern() = default;
+
+    Nfa::Fragment add_to_nfa(Nfa& nfa) const;
+    Instruction to_instruction(Program& program) const;
+
+    std::string print() const {return std::string("Alternate Marker Pattern to " + std::to_string(m_target));};
+
+    void set_target(std::size_t target) { m_target = target; };
+    std::size_t target() const { return m_target; };
+
+    static bool is_this_pattern(const PatternCursor& patterns);
 
   private:
-    std::string m_option1, m_option2;
+    std::size_t m_target = 0;
 };
 
 class ReferencePattern : public Pattern
 {
   public:
-    ReferencePattern(std::string& patterns, const std::shared_ptr<std::size_t>& referenceStart, int index);
+    ReferencePattern(PatternCursor& patterns, int index);
     ~ReferencePattern() = default;
 
-    std::size_t find_first_of(std::size_t pos, const std::string& input);
-    std::size_t starts_with(std::size_t pos, const std::string& input);
+    Nfa::Fragment add_to_nfa(Nfa& nfa) const;
+    Instruction to_instruction(Program& program) const;
+
+    std::string print() const {return std::string("Reference Pattern " + std::to_string(m_index));};
+
+    void set_end(std::size_t end) { m_end = end; };
 
-    std::string print() {return std::string("Reference Pattern " + std::to_string(m_index));};
+    int index() const { return m_index; };
+    std::size_t end() const { return m_end; };
 
-    static bool is_this_pattern(const std::string& patterns);
+    static bool is_this_pattern(const PatternCursor& patterns);
 
   private:
-    std::weak_ptr<std::size_t> m_referenceStart;
     int m_index;
+    std::size_t m_end = 0; // index of the matching EndReferencePattern
 };
 
 class EndReferencePattern : public Pattern
 {
   public:
-    EndReferencePattern(std::string& patterns, const std::shared_ptr<std::string>& referencePattern, const std::shared_ptr<std::size_t>& referenceStart);
+    EndReferencePattern(PatternCursor& patterns, int index, std::size_t start);
     ~EndReferencePattern() = default;
 
-    std::size_t find_first_of(std::size_t pos, const std::string& input);
-    std::size_t starts_with(std::size_t pos, const std::string& input);
+    Nfa::Fragment add_to_nfa(Nfa& nfa) const;
+    Instruction to_instruction(Program& program) const;
 
-    std::string print() {return std::string("End Reference Pattern");};
+    std::string print() const {return std::string("End Reference Pattern");};
 
-    static bool is_this_pattern(const std::string& patterns);
+    int index() const { return m_index; };
+    std::size_t start() const { return m_start; };
+
+    static bool is_this_pattern(const PatternCursor& patterns);
 
   private:
-    std::weak_ptr<std::string> m_referencePattern;
-    std::weak_ptr<std::size_t> m_referenceStart;
+    int m_index;
+    std::size_t m_start; // index of the matching ReferencePattern
 };
 
 class BackreferencePattern : public Pattern
 {
   public:
-    BackreferencePattern(std::string& patterns, const std::vector<std::shared_ptr<std::string>>& referencedPatterns);
+    BackreferencePattern(PatternCursor& patterns, std::size_t firstReference, std::size_t referenceCount);
     ~BackreferencePattern() = default;
 
-    std::size_t find_first_of(std::size_t pos, const std::string& input);
-    std::size_t starts_with(std::size_t pos, const std::string& input);
+    Nfa::Fragment add_to_nfa(Nfa& nfa) const;
+    Instruction to_instruction(Program& program) const;
+
+    bool needs_backtracking() const { return true; };
 
-    std::string print() {return std::string("Backreference Pattern " + std::to_string(m_index));};
+    std::string print() const {return std::string("Backreference Pattern " + std::to_string(m_index));};
 
-    static bool is_this_pattern(const std::string& patterns);
+    static bool is_this_pattern(const PatternCursor& patterns);
 
   private:
-    std::weak_ptr<std::string> m_referencedPattern;
     int m_index;
 };
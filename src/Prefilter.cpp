@@ -0,0 +1,152 @@
+#include "Prefilter.hpp"
+
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// bytes roughly ordered from most to least common in text and logs
+constexpr std::string_view COMMON_BYTES = " etaoinsrhldcumfpgwybvkxjqz0123456789ETAOINSRHLDCUMFPGWYBVKXJQZ.,:-_/=\"'()[]\t";
+
+/**********************************************************************
+ * commonness
+ *
+ * Returns: how common a byte is expected to be, rare bytes are 0
+ *********************************************************************/
+static std::size_t commonness(char c)
+{
+  std::size_t index = COMMON_BYTES.find(c);
+
+  return index == std::string_view::npos ? 0 : COMMON_BYTES.size() - index;
+}
+
+/**********************************************************************
+ * LiteralPrefilter
+ *
+ * Description: Prepares to search for a literal that must be in every
+ *      match, the two rarest bytes are picked to be checked first
+ *
+ * Parameters:
+ *   literal: the literal to search for
+ *********************************************************************/
+LiteralPrefilter::LiteralPrefilter(const std::string& literal)
+: m_literal(literal)
+{
+  for (std::size_t i = 1; i < m_literal.size(); ++i)
+  {
+    if (commonness(m_literal[i]) < commonness(m_literal[m_rareOffset1]))
+      m_rareOffset1 = i;
+  }
+
+  m_rareOffset2 = m_rareOffset1 == 0 ? m_literal.size() - 1 : 0;
+  for (std::size_t i = 0; i < m_literal.size(); ++i)
+  {
+    if (i != m_rareOffset1 && commonness(m_literal[i]) < commonness(m_literal[m_rareOffset2]))
+      m_rareOffset2 = i;
+  }
+}
+
+/**********************************************************************
+ * find
+ *
+ * Description: Finds the literal using the widest vector instructions
+ *      the CPU supports
+ *
+ * Parameters:
+ *   input: the string to search
+ *   pos: the position to start searching at
+ *
+ * Returns: the position of the start of the literal, npos if the input
+ *      doesn't contain it
+ *********************************************************************/
+std::size_t LiteralPrefilter::find(std::string_view input, std::size_t pos) const
+{
+  if (m_literal.size() <= 1)
+    return input.find(m_literal, pos);
+
+#if defined(__x86_64__)
+  static const bool haveAvx2 = __builtin_cpu_supports("avx2");
+
+  if (haveAvx2)
+    return findAvx2(input, pos);
+
+  return findSse2(input, pos);
+#else
+  return findScalar(input, pos);
+#endif
+}
+
+/**********************************************************************
+ * find kernels
+ *
+ * Description: Compare the two rare bytes at every start position in a
+ *      block at once, only positions where both match are compared
+ *      against the whole literal. The scalar version finishes the
+ *      positions left over after the last full block
+ *********************************************************************/
+std::size_t LiteralPrefilter::findScalar(std::string_view input, std::size_t pos) const
+{
+  const char* data = input.data();
+  const char rare1 = m_literal[m_rareOffset1], rare2 = m_literal[m_rareOffset2];
+
+  for (; pos + m_literal.size() <= input.size(); ++pos)
+  {
+    if (data[pos + m_rareOffset1] == rare1 && data[pos + m_rareOffset2] == rare2 && std::memcmp(data + pos, m_literal.data(), m_literal.size()) == 0)
+      return pos;
+  }
+
+  return std::string_view::npos;
+}
+
+#if defined(__x86_64__)
+std::size_t LiteralPrefilter::findSse2(std::string_view input, std::size_t pos) const
+{
+  const char* data = input.data();
+  const __m128i rare1 = _mm_set1_epi8(m_literal[m_rareOffset1]);
+  const __m128i rare2 = _mm_set1_epi8(m_literal[m_rareOffset2]);
+
+  // every start position in the block must leave room for the whole literal
+  for (; pos + 16 + m_literal.size() <= input.size() + 1; pos += 16)
+  {
+    __m128i block1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos + m_rareOffset1));
+    __m128i block2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos + m_rareOffset2));
+    unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(block1, rare1), _mm_cmpeq_epi8(block2, rare2)));
+
+    for (; mask != 0; mask &= mask - 1)
+    {
+      std::size_t candidate = pos + __builtin_ctz(mask);
+
+      if (std::memcmp(data + candidate, m_literal.data(), m_literal.size()) == 0)
+        return candidate;
+    }
+  }
+
+  return findScalar(input, pos);
+}
+
+__attribute__((target("avx2")))
+std::size_t LiteralPrefilter::findAvx2(std::string_view input, std::size_t pos) const
+{
+  const char* data = input.data();
+  const __m256i rare1 = _mm256_set1_epi8(m_literal[m_rareOffset1]);
+  const __m256i rare2 = _mm256_set1_epi8(m_literal[m_rareOffset2]);
+
+  for (; pos + 32 + m_literal.size() <= input.size() + 1; pos += 32)
+  {
+    __m256i block1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + pos + m_rareOffset1));
+    __m256i block2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + pos + m_rareOffset2));
+    unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(block1, rare1), _mm256_cmpeq_epi8(block2, rare2)));
+
+    for (; mask != 0; mask &= mask - 1)
+    {
+      std::size_t candidate = pos + __builtin_ctz(mask);
+
+      if (std::memcmp(data + candidate, m_literal.data(), m_literal.size()) == 0)
+        return candidate;
+    }
+  }
+
+  return findSse2(input, pos);
+}
+#endif
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+class LiteralPrefilter
+{
+  public:
+    LiteralPrefilter(const std::string& literal);
+    ~LiteralPrefilter() = default;
+
+    std::size_t find(std::string_view input, std::size_t pos = 0) const;
+
+    const std::string& literal() const { return m_literal; };
+
+  private:
+    std::size_t findScalar(std::string_view input, std::size_t pos) const;
+    std::size_t findSse2(std::string_view input, std::size_t pos) const;
+    std::size_t findAvx2(std::string_view input, std::size_t pos) const;
+
+    std::string m_literal;
+
+    // offsets of the two least common bytes in the literal, checked before the rest
+    std::size_t m_rareOffset1 = 0, m_rareOffset2 = 0;
+};
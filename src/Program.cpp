@@ -0,0 +1,450 @@
+#include "Program.hpp"
+
+#if DEBUGGING
+#include <iostream>
+#endif
+
+// run()'s choices, kept between runs so a search doesn't grow them again for every line
+static thread_local std::vector<Backtrack> t_backtracks;
+
+/**********************************************************************
+ * MatchState
+ *
+ * Parameters:
+ *   groups: how many groups the program has
+ *********************************************************************/
+MatchState::MatchState(std::size_t groups)
+: m_slots(m_inline.data())
+{
+  if (groups > INLINE_GROUPS)
+  {
+    m_overflow.resize(groups);
+    m_slots = m_overflow.data();
+  }
+}
+
+/**********************************************************************
+ * addClass
+ *
+ * Parameters:
+ *   characterClass: the bytes a Class instruction accepts
+ *
+ * Returns: the number to use as the instruction's argument
+ *********************************************************************/
+std::uint32_t Program::addClass(const CharacterClass& characterClass)
+{
+  m_classes.push_back(characterClass);
+
+  return m_classes.size() - 1;
+}
+
+/**********************************************************************
+ * add
+ *
+ * Parameters:
+ *   instruction: the next instruction, its index is the pattern's
+ *********************************************************************/
+void Program::add(const Instruction& instruction)
+{
+  m_instructions.push_back(instruction);
+
+#if GREP_STATS
+  m_instructionStats.emplace_back();
+#endif
+}
+
+/**********************************************************************
+ * addBranches
+ *
+ * Parameters:
+ *   branches: the index of the first instruction of each branch
+ *
+ * Returns: the number to use as the Alternation instruction's argument
+ *********************************************************************/
+std::uint32_t Program::addBranches(const std::vector<std::size_t>& branches)
+{
+  std::uint32_t first = m_branches.size();
+  m_branches.insert(m_branches.end(), branches.begin(), branches.end());
+
+  return first;
+}
+
+/**********************************************************************
+ * search
+ *
+ * Description: Runs the program from each position of the input in
+ *      turn. When the program has to start with a known byte the
+ *      positions that can't start a match are skipped over, and one
+ *      that starts with '^' is only run from the start
+ *
+ * Parameters:
+ *   input: the string to search, anchors still refer to its ends
+ *   from: the first position to try
+ *   pc: the instruction to start each attempt at
+ *   startsWith: only try the position from
+ *   state: storage for the groups
+ *   start: set to where the match starts
+ *
+ * Returns: the position after the first match, npos if no match
+ *********************************************************************/
+std::size_t Program::search(std::string_view input, std::size_t from, std::size_t pc, bool startsWith, MatchState& state, std::size_t& start) const
+{
+#if GREP_STATS
+  StatsTimer timer(m_searchStats);
+#endif
+
+  // groups that can't be skipped don't change where a match starts
+  std::size_t first = pc;
+  while (first < m_instructions.size() && m_instructions[first].op == OpCode::Reference &&
+         m_instructions[m_instructions[first].extra].min > 0)
+    ++first;
+
+  const Instruction* known = first < m_instructions.size() && m_instructions[first].min > 0 ? &m_instructions[first] : nullptr;
+
+  // a leading '^' can only pass at the start of the input so there is a single attempt
+  if (known && known->op == OpCode::AssertStart)
+  {
+    if (from > 0)
+      return std::string::npos;
+
+    startsWith = true;
+  }
+
+  bool skipCharacter = !startsWith && known && known->op == OpCode::Character;
+  bool skipClass = !startsWith && known && known->op == OpCode::Class;
+
+  for (std::size_t pos = from; pos <= input.size(); ++pos)
+  {
+    if (skipCharacter && (pos = input.find(known->character, pos)) == std::string_view::npos)
+      return std::string::npos;
+
+    if (skipClass && (pos = m_classes[known->argument].find(input, pos)) == std::string_view::npos)
+      return std::string::npos;
+
+#if GREP_STATS
+    m_searchStats.bytes.add();
+#endif
+
+    std::size_t result = run(input, pos, pc, state);
+    start = pos;
+
+    if (result != std::string::npos || startsWith)
+      return result;
+  }
+
+  return std::string::npos;
+}
+
+/**********************************************************************
+ * step
+ *
+ * Description: Matches one repeat of an instruction that always
+ *      consumes the same number of bytes
+ *
+ * Parameters:
+ *   instruction: a Character, Class, Any, anchor or Backreference
+ *   input: the string being matched
+ *   pos: the position to match at
+ *   state: the groups found so far
+ *
+ * Returns: the position after the instruction, npos if no match
+ *********************************************************************/
+std::size_t Program::step(const Instruction& instruction, std::string_view input, std::size_t pos, MatchState& state) const
+{
+  switch (instruction.op)
+  {
+    case OpCode::Character:
+      return pos < input.size() && input[pos] == instruction.character ? pos + 1 : std::string::npos;
+
+    case OpCode::Class:
+      return pos < input.size() && m_classes[instruction.argument].contains(input[pos]) ? pos + 1 : std::string::npos;
+
+    case OpCode::Any:
+      return pos < input.size() ? pos + 1 : std::string::npos;
+
+    case OpCode::AssertStart:
+      return pos == 0 ? pos : std::string::npos;
+
+    case OpCode::AssertEnd:
+      return pos == input.size() ? pos : std::string::npos;
+
+    case OpCode::Backreference:
+    {
+      // a reference that never matched can't match anything, otherwise compare in place
+      const CaptureSlot& capture = state[instruction.argument];
+      std::size_t length = capture.end - capture.start;
+      return capture.start != std::string::npos && input.compare(pos, length, input.substr(capture.start, length)) == 0 ? pos + length : std::string::npos;
+    }
+
+    default:
+      return std::string::npos;
+  }
+}
+
+/**********************************************************************
+ * run
+ *
+ * Description: Matches the instructions from pc onwards starting at
+ *      pos. Instructions that can only match one way are stepped over
+ *      in a loop, the choices (alternations, quantifiers and groups)
+ *      are kept on a stack with the ways they haven't tried yet so long
+ *      inputs can't run out of call stack. When the rest fails the
+ *      latest choice moves on to its next way, a group's slot is set up
+ *      for the way taken and put back once there are none left. A
+ *      repeated instruction always consumes the same width so it is
+ *      matched as often as allowed in one go and each count is a way
+ *
+ * Parameters:
+ *   input: the string being matched
+ *   pos: the position the match must start at
+ *   pc: the index of the first instruction to match
+ *   state: storage for the groups found so far
+ *
+ * Returns: the position after the rest of the instructions have been
+ *      matched, npos if no match
+ *********************************************************************/
+std::size_t Program::run(std::string_view input, std::size_t pos, std::size_t pc, MatchState& state) const
+{
+  std::vector<Backtrack>& backtracks = t_backtracks;
+  std::size_t newPos;
+
+  backtracks.clear();
+
+  while (true)
+  {
+    if (pc == m_instructions.size())
+      return pos;
+
+    const Instruction& instruction = m_instructions[pc];
+    [[maybe_unused]] bool failed = false;
+
+#if DEBUGGING
+    std::cout << "pos " << pos << " instruction " << pc << " op " << static_cast<int>(instruction.op) << std::endl;
+#endif
+
+#if GREP_STATS
+    m_instructionStats[pc].steps.add();
+#endif
+
+    switch (instruction.op)
+    {
+      case OpCode::Alternation:
+      case OpCode::Reference:
+      case OpCode::EndReference:
+      {
+        Backtrack& backtrack = backtracks.emplace_back();
+        backtrack.pc = pc;
+        backtrack.pos = pos;
+
+        if (instruction.op != OpCode::Alternation)
+          backtrack.previous = state[instruction.argument];
+
+        break;
+      }
+
+      // the branch matched so carry on after the alternation
+      case OpCode::AlternateMarker:
+        pc = instruction.argument;
+        continue;
+
+      // every repeat consumes the same width so only the count needs finding
+      default:
+      {
+        bool lazy = instruction.flags & Instruction::Lazy;
+        std::size_t count = 0;
+        std::size_t width = 0;
+
+        if (instruction.max > 0 && (newPos = step(instruction, input, pos, state)) != std::string::npos)
+        {
+          width = newPos - pos;
+
+          // a zero width match can be repeated as often as wanted without moving
+          count = width == 0 ? instruction.max : 1;
+
+          while (count < instruction.max && step(instruction, input, pos + count * width, state) != std::string::npos)
+            ++count;
+        }
+
+        if (count < instruction.min)
+        {
+          failed = true;
+          break;
+        }
+
+        // only counts that consume different widths are different ways
+        if (width == 0 || count == instruction.min)
+        {
+          pos += (lazy ? instruction.min : count) * width;
+          ++pc;
+          continue;
+        }
+
+        Backtrack& backtrack = backtracks.emplace_back();
+        backtrack.pc = pc;
+        backtrack.pos = pos;
+        backtrack.count = lazy ? instruction.min : count;
+        backtrack.end = lazy ? count + 1 : static_cast<std::size_t>(instruction.min) - 1;
+        backtrack.width = width;
+        break;
+      }
+    }
+
+    // take the next way of the latest choice, one with none left is dropped for the one before it
+    for (bool taken = false; !taken; failed = true)
+    {
+      if (backtracks.empty())
+        return std::string::npos;
+
+      Backtrack& backtrack = backtracks.back();
+      const Instruction& choice = m_instructions[backtrack.pc];
+      bool lazy = choice.flags & Instruction::Lazy;
+
+#if GREP_STATS
+      if (failed)
+        m_instructionStats[backtrack.pc].backtracks.add();
+#endif
+
+      pos = backtrack.pos;
+
+      switch (choice.op)
+      {
+        // each branch is tried with the rest of the instructions after the alternation
+        case OpCode::Alternation:
+          pc = m_branches[choice.argument + backtrack.step++];
+          taken = true;
+
+          if (backtrack.step == choice.extra)
+            backtracks.pop_back();
+          break;
+
+        // a group that can be skipped is tried before or after skipping it depending on its quantifier
+        case OpCode::Reference:
+        {
+          const Instruction& end = m_instructions[choice.extra];
+          bool skippable = end.min == 0;
+          bool skipFirst = skippable && (end.flags & Instruction::Lazy);
+          CaptureSlot& capture = state[choice.argument];
+
+          capture.groupStart = backtrack.previous.groupStart;
+          capture.count = backtrack.previous.count;
+
+          while (backtrack.step < 2 && !taken)
+          {
+            bool enter = (backtrack.step++ == 0) != skipFirst;
+
+            if (enter && end.max > 0)
+            {
+              capture.groupStart = pos;
+              capture.count = 0;
+              pc = backtrack.pc + 1;
+              taken = true;
+            }
+            else if (!enter && skippable)
+            {
+              pc = choice.extra + 1;
+              taken = true;
+            }
+          }
+
+          if (!taken)
+            backtracks.pop_back();
+          break;
+        }
+
+        case OpCode::EndReference:
+        {
+          CaptureSlot& capture = state[choice.argument];
+          const CaptureSlot& previous = backtrack.previous;
+          capture.start = previous.groupStart;
+          capture.end = pos;
+          capture.groupStart = previous.groupStart;
+          capture.count = previous.count + 1;
+
+          // going round again has to consume something once the minimum is reached or it never ends
+          bool again = capture.count < choice.max && (pos != previous.groupStart || capture.count < choice.min);
+          bool leave = capture.count >= choice.min;
+
+          while (backtrack.step < 3 && !taken)
+          {
+            std::uint32_t step = backtrack.step++;
+
+            if (step == 1 && again)
+            {
+              capture.groupStart = pos;
+              pc = choice.extra + 1;
+              taken = true;
+            }
+            else if (step != 1 && leave && (step == 0) == lazy)
+            {
+              pc = backtrack.pc + 1;
+              taken = true;
+            }
+          }
+
+          if (!taken)
+          {
+            capture = previous;
+            backtracks.pop_back();
+          }
+          break;
+        }
+
+        // greedy tries the most repeats first, lazy the fewest
+        default:
+          pos += backtrack.count * backtrack.width;
+          pc = backtrack.pc + 1;
+          taken = true;
+          lazy ? ++backtrack.count : --backtrack.count;
+
+          if (backtrack.count == backtrack.end)
+            backtracks.pop_back();
+          break;
+      }
+    }
+  }
+}
+
+#if GREP_STATS
+/**********************************************************************
+ * writeStats
+ *
+ * Description: Writes the search counts and each instruction's, steps
+ *      is how often it was reached and backtracks how often a way of
+ *      matching it was given up on
+ *
+ * Parameters:
+ *   json: where to write the counts
+ *********************************************************************/
+void Program::writeStats(JsonWriter& json) const
+{
+  static constexpr const char* opNames[] = {
+    "Character", "Class", "Any", "AssertStart", "AssertEnd", "Alternation", "AlternateMarker", "Reference", "EndReference", "Backreference"
+  };
+
+  json.engine("backtracker", m_searchStats);
+  json.beginArray("instructions");
+
+  for (std::size_t pc = 0; pc < m_instructions.size(); ++pc)
+  {
+    const Instruction& instruction = m_instructions[pc];
+
+    json.beginObject();
+    json.field("index", static_cast<std::uint64_t>(pc));
+    json.field("op", opNames[static_cast<std::size_t>(instruction.op)]);
+
+    if (instruction.op == OpCode::Character)
+      json.field("character", std::string_view(&instruction.character, 1));
+
+    json.field("min", static_cast<std::uint64_t>(instruction.min));
+
+    if (instruction.max != UINT32_MAX)
+      json.field("max", static_cast<std::uint64_t>(instruction.max));
+
+    json.field("steps", m_instructionStats[pc].steps.value());
+    json.field("backtracks", m_instructionStats[pc].backtracks.value());
+    json.endObject();
+  }
+
+  json.endArray();
+}
+#endif
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "CharacterClass.hpp"
+#include "Stats.hpp"
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if GREP_STATS
+#include <deque>
+#endif
+
+// a group as offsets into the input, the text is never copied
+struct CaptureSlot
+{
+  std::size_t groupStart = std::string::npos; // where the group was last entered
+  std::size_t start = std::string::npos;      // the last text the group matched, npos until it has
+  std::size_t end = std::string::npos;
+  std::size_t count = 0;                      // times round the group so far, for its quantifier
+};
+
+// a choice the backtracker can come back to with the ways of matching the
+// instruction it hasn't tried yet
+struct Backtrack
+{
+  std::uint32_t pc = 0;
+  std::uint32_t step = 0; // the next branch or step of a group to try
+  std::size_t pos = 0;    // where the instruction was reached
+  std::size_t count = 0;  // the next repeat count to try
+  std::size_t end = 0;    // a repeat count one past the last to try
+  std::size_t width = 0;  // how much one repeat consumes
+  CaptureSlot previous;   // a group's slot to put back once every way has failed
+};
+
+// per match storage for the groups so compiled patterns can be shared, the
+// slots for a few groups live inline so a match doesn't allocate
+class MatchState
+{
+  public:
+    MatchState(std::size_t groups);
+    ~MatchState() = default;
+
+    MatchState(const MatchState&) = delete;
+    MatchState& operator=(const MatchState&) = delete;
+
+    CaptureSlot& operator[](std::size_t group) { return m_slots[group]; };
+
+  private:
+    static constexpr std::size_t INLINE_GROUPS = 16;
+
+    std::array<CaptureSlot, INLINE_GROUPS> m_inline;
+    std::vector<CaptureSlot> m_overflow;
+    CaptureSlot* m_slots;
+};
+
+enum class OpCode : std::uint8_t
+{
+  Character,       // one byte equal to character
+  Class,           // one byte in the class numbered argument
+  Any,             // any one byte
+  AssertStart,     // only at the start of the input
+  AssertEnd,       // only at the end of the input
+  Alternation,     // try each branch listed from branch argument, extra of them
+  AlternateMarker, // the branch matched so continue at argument
+  Reference,       // group argument starts here, its EndReference is at extra
+  EndReference,    // group argument ends here, its Reference is at extra
+  Backreference    // the text group argument captured
+};
+
+// one pattern of the pattern list, the instruction at an index is the
+// pattern at the same index so branch and group indexes carry over. The
+// quantifier is a count so repeats are never written out, a group's is on
+// its EndReference
+struct Instruction
+{
+  static constexpr std::uint8_t Lazy = 1 << 0; // fewest repeats first
+
+  OpCode op = OpCode::Any;
+  std::uint8_t flags = 0;
+  char character = 0;
+  std::uint32_t argument = 0;
+  std::uint32_t extra = 0;
+  std::uint32_t min = 1;
+  std::uint32_t max = 1; // UINT32_MAX for no limit
+};
+
+// the backtracker, runs a flat array of instructions with a switch instead
+// of calling through the pattern objects
+class Program
+{
+  public:
+    Program() = default;
+    ~Program() = default;
+
+    std::uint32_t addClass(const CharacterClass& characterClass);
+    std::uint32_t addBranches(const std::vector<std::size_t>& branches);
+    void add(const Instruction& instruction);
+
+    bool empty() const { return m_instructions.empty(); };
+
+    std::size_t search(std::string_view input, std::size_t from, std::size_t pc, bool startsWith, MatchState& state, std::size_t& start) const;
+    std::size_t run(std::string_view input, std::size_t pos, std::size_t pc, MatchState& state) const;
+
+#if GREP_STATS
+    void writeStats(JsonWriter& json) const;
+#endif
+
+  private:
+    std::size_t step(const Instruction& instruction, std::string_view input, std::size_t pos, MatchState& state) const;
+
+    std::vector<Instruction> m_instructions;
+    std::vector<CharacterClass> m_classes;
+    std::vector<std::uint32_t> m_branches;
+
+#if GREP_STATS
+    // what --stats reports, positions tried by search() and one entry per
+    // instruction, a deque since the counters can't be moved
+    mutable EngineStats m_searchStats;
+    mutable std::deque<InstructionStats> m_instructionStats;
+#endif
+};
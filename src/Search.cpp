@@ -0,0 +1,1032 @@
+#include "Search.hpp"
+#include "GrepCore.hpp"
+#include "MappedFile.hpp"
+#include "WorkStealingPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+// size of each read from an input stream and of the pending output
+constexpr std::size_t READ_BUFFER_SIZE = 1 << 20;
+constexpr std::size_t WRITE_BUFFER_SIZE = 1 << 16;
+
+// files smaller than this aren't worth splitting between threads
+constexpr std::size_t PARALLEL_MIN_SIZE = 1 << 24;
+constexpr std::size_t MIN_CHUNK_SIZE = 1 << 20;
+constexpr std::size_t CHUNKS_PER_THREAD = 4;
+
+// blocks of a stream that can be read ahead of the writer, this bounds the memory used
+constexpr std::size_t BLOCKS_PER_THREAD = 2;
+
+// a stream line longer than this is matched as it is read instead of being held whole
+constexpr std::size_t LONG_LINE_SIZE = READ_BUFFER_SIZE;
+
+/**********************************************************************
+ * OutputBuffer append
+ *
+ * Description: Adds a matching line to the output, writing it out once
+ *      enough has been collected unless it must be written all at once
+ *
+ * Parameters:
+ *   prefix: printed before the line (usually the file name)
+ *   line: the matching line without its newline
+ *********************************************************************/
+void OutputBuffer::append(std::string_view prefix, std::string_view line)
+{
+  m_buffer += prefix;
+  m_buffer += line;
+  m_buffer += '\n';
+
+  if (m_flushWhenFull && m_buffer.size() >= WRITE_BUFFER_SIZE)
+    flush();
+}
+
+/**********************************************************************
+ * OutputBuffer append
+ *
+ * Description: Moves everything collected by another buffer onto the
+ *      end of this one so many small outputs are written together
+ *
+ * Parameters:
+ *   other: the buffer to empty into this one
+ *********************************************************************/
+void OutputBuffer::append(OutputBuffer& other)
+{
+  if (m_buffer.empty())
+    m_buffer.swap(other.m_buffer);
+  else
+    m_buffer += other.m_buffer;
+
+  other.m_buffer.clear();
+
+  if (m_flushWhenFull && m_buffer.size() >= WRITE_BUFFER_SIZE)
+    flush();
+}
+
+/**********************************************************************
+ * OutputBuffer appendPart
+ *
+ * Description: Adds part of a line too long to be held at once, the
+ *      caller ends the line by adding its newline
+ *
+ * Parameters:
+ *   part: the next bytes of the line
+ *********************************************************************/
+void OutputBuffer::appendPart(std::string_view part)
+{
+  m_buffer += part;
+
+  if (m_flushWhenFull && m_buffer.size() >= WRITE_BUFFER_SIZE)
+    flush();
+}
+
+void OutputBuffer::flush()
+{
+  std::cout.write(m_buffer.data(), m_buffer.size());
+  m_buffer.clear();
+}
+
+/**********************************************************************
+ * lineAround
+ *
+ * Description: Finds the line holding a position
+ *
+ * Parameters:
+ *   data: the lines being searched
+ *   start: the start of the first line that could hold the position
+ *   pos: the position in the line
+ *
+ * Returns: the line without its newline
+ *********************************************************************/
+static std::string_view lineAround(std::string_view data, std::size_t start, std::size_t pos)
+{
+  std::size_t lineStart = data.rfind('\n', pos);
+  lineStart = lineStart == std::string_view::npos || lineStart < start ? start : lineStart + 1;
+
+  std::size_t end = data.find('\n', pos);
+  if (end == std::string_view::npos)
+    end = data.size();
+
+  return data.substr(lineStart, end - lineStart);
+}
+
+/**********************************************************************
+ * noNewlines
+ *
+ * Returns: true if none of the keywords could span two lines
+ *********************************************************************/
+static bool noNewlines(const std::vector<std::string>& keywords)
+{
+  return std::none_of(keywords.begin(), keywords.end(), [](const std::string& keyword) { return keyword.find('\n') != std::string::npos; });
+}
+
+#if GREP_STATS
+/**********************************************************************
+ * recordSkipped
+ *
+ * Description: Counts the lines a search jumped over because they don't
+ *      hold a filter's literals, each one was checked and didn't pass
+ *
+ * Parameters:
+ *   filter: the filter whose literals were searched for
+ *   skipped: the lines jumped over
+ *********************************************************************/
+static void recordSkipped(FilterStats& filter, std::string_view skipped)
+{
+  std::uint64_t lines = std::count(skipped.begin(), skipped.end(), '\n');
+  if (!skipped.empty() && skipped.back() != '\n')
+    ++lines;
+
+  filter.checked.add(lines);
+}
+#endif
+
+/**********************************************************************
+ * appendLine
+ *
+ * Description: Outputs a matching line the way the options ask for,
+ *      with -o every non-empty match in the line is output on its own
+ *      instead
+ *
+ * Parameters:
+ *   line: the matching line without its newline
+ *   offset: where the line starts in the input
+ *   pattern: the compiled patterns the line matched
+ *   prefix: printed before the line or each match
+ *   output: where matching lines are collected
+ *   options: how matching lines are reported
+ *********************************************************************/
+static void appendLine(std::string_view line, std::size_t offset, const CompiledPattern& pattern, std::string_view prefix, OutputBuffer& output, const OutputOptions& options)
+{
+  if (options.countOnly)
+    return;
+
+  if (!options.onlyMatching)
+  {
+    if (options.byteOffset)
+      output.append(std::string(prefix) + std::to_string(offset) + ":", line);
+    else
+      output.append(prefix, line);
+
+    return;
+  }
+
+  for (const GrepMatch& match : GrepMatches(pattern, line))
+  {
+    // like grep an empty match isn't worth a line
+    if (match.start == match.end)
+      continue;
+
+    if (options.byteOffset)
+      output.append(std::string(prefix) + std::to_string(offset + match.start) + ":", match.text());
+    else
+      output.append(prefix, match.text());
+  }
+}
+
+/**********************************************************************
+ * appendPatternSetLine
+ *
+ * Description: Outputs a line if any pattern of a pattern set matches
+ *      it, the IDs of the patterns that matched are printed between the
+ *      prefix and the line
+ *
+ * Parameters:
+ *   line: the line to match
+ *   offset: where the line starts in the input
+ *   pattern: the compiled pattern set
+ *   prefix: printed before the pattern IDs
+ *   output: where matching lines are collected
+ *   options: how matching lines are reported
+ *   ids: scratch space for the matching patterns
+ *
+ * Returns: true if the line matched
+ *********************************************************************/
+static bool appendPatternSetLine(std::string_view line, std::size_t offset, const CompiledPattern& pattern, std::string_view prefix, OutputBuffer& output,
+                                 const OutputOptions& options, std::vector<std::size_t>& ids)
+{
+  pattern.matchingPatterns(line, ids);
+
+  if (ids.empty())
+    return false;
+
+  // IDs count from 1 like the lines of the pattern file
+  std::string labels(prefix);
+  for (std::size_t i = 0; i < ids.size(); ++i)
+    labels += (i > 0 ? "," : "") + std::to_string(ids[i] + 1);
+  labels += ':';
+
+  appendLine(line, offset, pattern, labels, output, options);
+
+  return true;
+}
+
+/**********************************************************************
+ * searchPatternSetLines
+ *
+ * Description: Matches every line in the data against a pattern set,
+ *      with keywords or when every pattern needs a literal only the
+ *      lines holding one are checked
+ *
+ * Parameters:
+ *   data: the lines to search
+ *   pattern: the compiled pattern set
+ *   prefix: printed before each matching line
+ *   output: where matching lines are collected
+ *   options: how matching lines are reported
+ *   offset: where the data starts in the input
+ *
+ * Returns: how many lines matched
+ *********************************************************************/
+static std::size_t searchPatternSetLines(std::string_view data, const CompiledPattern& pattern, std::string_view prefix, OutputBuffer& output, const OutputOptions& options, std::size_t offset)
+{
+  std::vector<std::size_t> ids;
+  std::size_t count = 0;
+  std::size_t start = 0;
+
+  // a line without any pattern's literals can't match so those are skipped in one pass
+  const AhoCorasick* keywords = pattern.keywords() ? pattern.keywords() : pattern.setLiterals();
+
+  if (keywords && noNewlines(keywords->keywords()))
+  {
+    std::size_t pos;
+
+#if GREP_STATS
+    FilterStats& stats = pattern.keywords() ? pattern.keywordStats() : pattern.setLiteralStats();
+#endif
+
+    while (start < data.size() && (pos = keywords->find(data, start)) != std::string_view::npos)
+    {
+      std::string_view line = lineAround(data, start, pos);
+      std::size_t lineStart = line.data() - data.data();
+
+#if GREP_STATS
+      // matchingPatterns() checks the set's literals again itself, but not keywords
+      recordSkipped(stats, data.substr(start, lineStart - start));
+      if (pattern.keywords())
+        stats.record(true);
+#endif
+
+      count += appendPatternSetLine(line, offset + lineStart, pattern, prefix, output, options, ids);
+
+      start = lineStart + line.size() + 1;
+    }
+
+#if GREP_STATS
+    if (start < data.size())
+      recordSkipped(stats, data.substr(start));
+#endif
+
+    return count;
+  }
+
+  while (start < data.size())
+  {
+    std::size_t end = data.find('\n', start);
+    if (end == std::string_view::npos)
+      end = data.size();
+
+    count += appendPatternSetLine(data.substr(start, end - start), offset + start, pattern, prefix, output, options, ids);
+
+    start = end + 1;
+  }
+
+  return count;
+}
+
+/**********************************************************************
+ * searchLines
+ *
+ * Description: Matches every line in the data in place and outputs the
+ *      ones that match, a final line without a newline is still checked.
+ *      When the patterns need a literal only lines containing it are
+ *      matched and lines with a keyword of a literal alternation match
+ *      without being checked again. A pattern set reports which of its
+ *      patterns matched each line
+ *
+ * Parameters:
+ *   data: the lines to search
+ *   pattern: the compiled patterns to match each line against
+ *   prefix: printed before each matching line
+ *   output: where matching lines are collected
+ *   options: how matching lines are reported
+ *   offset: where the data starts in the input, for -b
+ *
+ * Returns: how many lines matched
+ *********************************************************************/
+std::size_t searchLines(std::string_view data, const CompiledPattern& pattern, std::string_view prefix, OutputBuffer& output, const OutputOptions& options, std::size_t offset)
+{
+  if (pattern.isPatternSet())
+    return searchPatternSetLines(data, pattern, prefix, output, options, offset);
+
+  std::size_t count = 0;
+  std::size_t start = 0;
+
+  // jump between lines with one of the keywords, the keyword alone is a match
+  if (const AhoCorasick* keywords = pattern.keywords(); keywords && noNewlines(keywords->keywords()))
+  {
+    std::size_t pos;
+
+    while (start < data.size() && (pos = keywords->find(data, start)) != std::string_view::npos)
+    {
+      std::string_view line = lineAround(data, start, pos);
+      std::size_t lineStart = line.data() - data.data();
+
+#if GREP_STATS
+      recordSkipped(pattern.keywordStats(), data.substr(start, lineStart - start));
+      pattern.keywordStats().record(true);
+#endif
+
+      ++count;
+      appendLine(line, offset + lineStart, pattern, prefix, output, options);
+
+      start = lineStart + line.size() + 1;
+    }
+
+#if GREP_STATS
+    if (start < data.size())
+      recordSkipped(pattern.keywordStats(), data.substr(start));
+#endif
+
+    return count;
+  }
+
+  // jump between occurrences of the required literal, other lines can't match
+  if (const LiteralPrefilter* prefilter = pattern.prefilter(); prefilter && prefilter->literal().find('\n') == std::string::npos)
+  {
+    std::size_t pos;
+
+    while (start < data.size() && (pos = prefilter->find(data, start)) != std::string_view::npos)
+    {
+      std::string_view line = lineAround(data, start, pos);
+      std::size_t lineStart = line.data() - data.data();
+
+#if GREP_STATS
+      recordSkipped(pattern.prefilterStats(), data.substr(start, lineStart - start));
+      pattern.prefilterStats().record(true);
+#endif
+
+      // the literal was just found in the line so matches() needn't look for it
+      if (pattern.matches(line, true))
+      {
+        ++count;
+        appendLine(line, offset + lineStart, pattern, prefix, output, options);
+      }
+
+      start = lineStart + line.size() + 1;
+    }
+
+#if GREP_STATS
+    if (start < data.size())
+      recordSkipped(pattern.prefilterStats(), data.substr(start));
+#endif
+
+    return count;
+  }
+
+  while (start < data.size())
+  {
+    std::size_t end = data.find('\n', start);
+    if (end == std::string_view::npos)
+      end = data.size();
+
+    std::string_view line = data.substr(start, end - start);
+
+    if (pattern.matches(line))
+    {
+      ++count;
+      appendLine(line, offset + start, pattern, prefix, output, options);
+    }
+
+    start = end + 1;
+  }
+
+  return count;
+}
+
+// a stream line too long to hold, kept in a temporary file once it has
+// matched until it can be written out
+struct LongLine
+{
+  struct Closer
+  {
+    void operator()(std::FILE* file) const { std::fclose(file); };
+  };
+
+  std::unique_ptr<std::FILE, Closer> file;
+  std::string label; // printed before the line
+};
+
+/**********************************************************************
+ * canMatchLongLines
+ *
+ * Returns: true if a line can be matched a piece at a time, the DFA
+ *      can carry on between pieces but the NFA only knows where a -o
+ *      match ends once it has read past it, so -o holds the line, and
+ *      the backtracker needs it to go back to
+ *********************************************************************/
+static bool canMatchLongLines(const CompiledPattern& pattern, const OutputOptions& options)
+{
+  return pattern.nfa() && !options.onlyMatching;
+}
+
+/**********************************************************************
+ * searchLongLine
+ *
+ * Description: Finishes a line that has outgrown the read size without
+ *      holding it, the rest of the line is read a block at a time and
+ *      run through the DFA from the state the previous block left it
+ *      in. Unless only counting, the line is copied to a temporary file
+ *      as it is read so it can still be written if it matched
+ *
+ * Parameters:
+ *   stream: the stream the line is read from
+ *   data: the start of the line, replaced by whatever was read after it
+ *   offset: where the line starts in the stream, moved on to where the
+ *       bytes left in data start
+ *   pattern: the compiled patterns to match the line against
+ *   prefix: printed before the line
+ *   options: how matching lines are reported
+ *   line: given the copy of the line and what goes before it if it matched
+ *
+ * Returns: 1 if the line matched, 0 otherwise
+ *********************************************************************/
+static std::size_t searchLongLine(std::istream& stream, std::string& data, std::size_t& offset, const CompiledPattern& pattern, std::string_view prefix,
+                                  const OutputOptions& options, LongLine& line)
+{
+  const Nfa& nfa = *pattern.nfa();
+  Nfa::Scan scan;
+  std::size_t lineOffset = offset;
+
+  if (!options.countOnly)
+  {
+    line.file.reset(std::tmpfile());
+    if (!line.file)
+      throw std::runtime_error("Unable to create a temporary file for a long line");
+  }
+
+  auto add = [&](std::string_view piece)
+  {
+    nfa.scan(scan, piece);
+    offset += piece.size();
+
+    if (line.file && std::fwrite(piece.data(), 1, piece.size(), line.file.get()) != piece.size())
+      throw std::runtime_error("Unable to write a long line to a temporary file");
+  };
+
+  add(data);
+
+  std::size_t end = std::string::npos;
+  while (end == std::string::npos && stream)
+  {
+    data.resize(READ_BUFFER_SIZE);
+    stream.read(data.data(), READ_BUFFER_SIZE);
+    data.resize(stream.gcount());
+
+    end = data.find('\n');
+    add(std::string_view(data).substr(0, end));
+  }
+
+  // what follows the newline belongs to the lines after this one
+  if (end != std::string::npos)
+  {
+    data.erase(0, end + 1);
+    ++offset;
+  }
+  else
+  {
+    data.clear();
+  }
+
+  std::vector<std::size_t> ids;
+  nfa.finishScan(scan, ids);
+
+  if (ids.empty())
+  {
+    line.file.reset();
+    return 0;
+  }
+
+  line.label = prefix;
+
+  if (pattern.isPatternSet())
+  {
+    for (std::size_t i = 0; i < ids.size(); ++i)
+      line.label += (i > 0 ? "," : "") + std::to_string(ids[i] + 1);
+    line.label += ':';
+  }
+
+  if (options.byteOffset)
+    line.label += std::to_string(lineOffset) + ":";
+
+  return 1;
+}
+
+/**********************************************************************
+ * writeLongLine
+ *
+ * Description: Copies a long line that matched from its temporary file
+ *      to the output a piece at a time
+ *
+ * Parameters:
+ *   line: the line, its file is closed once copied
+ *   output: where matching lines are collected
+ *********************************************************************/
+static void writeLongLine(LongLine& line, OutputBuffer& output)
+{
+  if (!line.file)
+    return;
+
+  std::vector<char> buffer(WRITE_BUFFER_SIZE);
+  std::rewind(line.file.get());
+  output.appendPart(line.label);
+
+  while (std::size_t size = std::fread(buffer.data(), 1, buffer.size(), line.file.get()))
+    output.appendPart(std::string_view(buffer.data(), size));
+
+  output.appendPart("\n");
+  line.file.reset();
+}
+
+/**********************************************************************
+ * searchStream
+ *
+ * Description: Reads the whole stream in large blocks and searches the
+ *      complete lines of each block in place, only a line split across
+ *      two blocks is copied. A line that outgrows the read size is
+ *      matched as it is read so memory stays bounded, except with -o or
+ *      a pattern needing the backtracker where the whole line is held
+ *
+ * Parameters:
+ *   stream: the stream to read lines from
+ *   pattern: the compiled patterns to match each line against
+ *   prefix: printed before each matching line
+ *   output: where matching lines are collected
+ *   options: how matching lines are reported
+ *
+ * Returns: how many lines matched
+ *********************************************************************/
+std::size_t searchStream(std::istream& stream, const CompiledPattern& pattern, std::string_view prefix, OutputBuffer& output, const OutputOptions& options)
+{
+  std::string data; // the partial line carried over followed by the block just read
+  std::size_t count = 0;
+  std::size_t offset = 0; // where data starts in the stream
+
+  while (stream)
+  {
+    std::size_t size = data.size();
+    data.resize(size + READ_BUFFER_SIZE);
+    stream.read(data.data() + size, READ_BUFFER_SIZE);
+    data.resize(size + stream.gcount());
+
+    // only the new bytes need looking at, the partial line has no newline
+    std::size_t last = std::string_view(data).substr(size).rfind('\n');
+
+    if (last != std::string::npos)
+    {
+      last += size;
+    }
+    else if (stream && data.size() >= LONG_LINE_SIZE && canMatchLongLines(pattern, options))
+    {
+      LongLine line;
+      count += searchLongLine(stream, data, offset, pattern, prefix, options, line);
+      writeLongLine(line, output);
+
+      last = data.rfind('\n');
+    }
+
+    if (last == std::string::npos)
+      continue;
+
+    count += searchLines(std::string_view(data).substr(0, last + 1), pattern, prefix, output, options, offset);
+
+    // keep the partial line until the rest of it is read
+    data.erase(0, last + 1);
+    offset += last + 1;
+  }
+
+  // last line may not have a newline
+  if (!data.empty())
+    count += searchLines(data, pattern, prefix, output, options, offset);
+
+  return count;
+}
+
+// one block of a stream being searched in the pipeline, unlike a Chunk it
+// owns its bytes since the stream can't be mapped
+struct StreamBlock
+{
+  std::string data;
+  std::size_t offset = 0;
+  OutputBuffer output{false};
+  std::size_t count = 0;
+  LongLine longLine; // a matching line too long to be held in data
+  bool done = false;
+};
+
+/**********************************************************************
+ * searchStreamPipelined
+ *
+ * Description: Searches a stream in three stages so reading, matching
+ *      and writing overlap. This thread reads complete lines into
+ *      blocks, a pool of threads searches the blocks and a writer
+ *      thread collects their output in stream order into large writes.
+ *      Only a few blocks per thread are in flight at once and their
+ *      buffers are reused so memory stays bounded however long the
+ *      stream is. A line that outgrows a block is matched by this thread
+ *      as it is read and handed to the writer in a block of its own, only
+ *      with -o or a pattern needing the backtracker does it grow its
+ *      block until the line is complete
+ *
+ * Parameters:
+ *   stream: the stream to read lines from
+ *   pattern: the compiled patterns shared by every thread
+ *   prefix: printed before each matching line
+ *   output: where matching lines are collected
+ *   threadCount: how many threads to search with
+ *   options: how matching lines are reported
+ *
+ * Returns: how many lines matched
+ *********************************************************************/
+std::size_t searchStreamPipelined(std::istream& stream, const CompiledPattern& pattern, std::string_view prefix, OutputBuffer& output, unsigned threadCount,
+                                  const OutputOptions& options)
+{
+  if (threadCount <= 1)
+    return searchStream(stream, pattern, prefix, output, options);
+
+  std::mutex lock;
+  std::condition_variable changed;
+  std::deque<std::unique_ptr<StreamBlock>> blocks; // read but not yet written, in stream order
+  std::vector<std::string> spareBuffers;
+  bool finished = false;
+  std::size_t count = 0;
+
+  WorkStealingPool pool(threadCount);
+
+  std::thread writer([&]
+  {
+    for (;;)
+    {
+      std::unique_ptr<StreamBlock> block;
+
+      {
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [&] { return (!blocks.empty() && blocks.front()->done) || (finished && blocks.empty()); });
+
+        if (blocks.empty())
+          break;
+
+        block = std::move(blocks.front());
+        blocks.pop_front();
+      }
+
+      output.append(block->output);
+      writeLongLine(block->longLine, output);
+      count += block->count;
+
+      std::lock_guard<std::mutex> guard(lock);
+      spareBuffers.push_back(std::move(block->data));
+      changed.notify_all();
+    }
+
+    output.flush();
+  });
+
+  std::string partial; // the start of a line the next block finishes, or what followed a long line
+  std::size_t offset = 0;
+
+  while (stream || !partial.empty())
+  {
+    auto block = std::make_unique<StreamBlock>();
+
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      changed.wait(guard, [&] { return blocks.size() < threadCount * BLOCKS_PER_THREAD; });
+
+      if (!spareBuffers.empty())
+      {
+        block->data = std::move(spareBuffers.back());
+        spareBuffers.pop_back();
+      }
+    }
+
+    block->data.assign(partial);
+    block->offset = offset;
+    partial.clear();
+
+    // keep reading until the block ends in a complete line or the stream ends,
+    // what followed a long line can already hold complete lines
+    std::size_t last = block->data.rfind('\n');
+    bool longLine = false;
+
+    while (last == std::string::npos && stream && !longLine)
+    {
+      std::size_t size = block->data.size();
+      block->data.resize(size + READ_BUFFER_SIZE);
+      stream.read(block->data.data() + size, READ_BUFFER_SIZE);
+      block->data.resize(size + stream.gcount());
+
+      // only the new bytes need looking at, the earlier ones had no newline
+      last = std::string_view(block->data).substr(size).rfind('\n');
+      if (last != std::string::npos)
+        last += size;
+
+      longLine = last == std::string::npos && stream && block->data.size() >= LONG_LINE_SIZE && canMatchLongLines(pattern, options);
+    }
+
+    // the block holds nothing but the start of the line, it is finished here
+    // and the block only passes its output on to the writer in stream order
+    if (longLine)
+    {
+      block->count = searchLongLine(stream, block->data, offset, pattern, prefix, options, block->longLine);
+      block->done = true;
+      partial.assign(block->data);
+      block->data.clear();
+
+      std::lock_guard<std::mutex> guard(lock);
+      blocks.push_back(std::move(block));
+      changed.notify_all();
+      continue;
+    }
+
+    // the final line may not have a newline
+    if (stream && last != std::string::npos)
+    {
+      partial.assign(block->data, last + 1);
+      block->data.resize(last + 1);
+    }
+
+    offset += block->data.size();
+
+    if (block->data.empty())
+      break;
+
+    std::lock_guard<std::mutex> guard(lock);
+    blocks.push_back(std::move(block));
+
+    pool.submit([&, block = blocks.back().get()]
+    {
+      block->count = searchLines(block->data, pattern, prefix, block->output, options, block->offset);
+
+      std::lock_guard<std::mutex> guard(lock);
+      block->done = true;
+      changed.notify_all();
+    });
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    finished = true;
+    changed.notify_all();
+  }
+
+  writer.join();
+
+  return count;
+}
+
+// one piece of a file being searched in parallel
+struct Chunk
+{
+  std::string_view data;
+  std::size_t offset = 0;
+  OutputBuffer output{false};
+  std::size_t count = 0;
+  bool done = false;
+};
+
+/**********************************************************************
+ * searchLinesParallel
+ *
+ * Description: Splits the data into chunks that end on a newline and
+ *      searches them on a pool of threads, each chunk's output is
+ *      written as soon as every chunk before it has been so the lines
+ *      come out in their original order
+ *
+ * Parameters:
+ *   data: the lines to search
+ *   pattern: the compiled patterns shared by every thread
+ *   prefix: printed before each matching line
+ *   output: where earlier matching lines were collected
+ *   threadCount: how many threads to search with
+ *   options: how matching lines are reported
+ *
+ * Returns: how many lines matched
+ *********************************************************************/
+std::size_t searchLinesParallel(std::string_view data, const CompiledPattern& pattern, std::string_view prefix, OutputBuffer& output, unsigned threadCount, const OutputOptions& options)
+{
+  if (threadCount <= 1 || data.size() < PARALLEL_MIN_SIZE)
+    return searchLines(data, pattern, prefix, output, options);
+
+  // more chunks than threads so a slow chunk doesn't hold the others up
+  std::size_t chunkSize = std::max(data.size() / (threadCount * CHUNKS_PER_THREAD), MIN_CHUNK_SIZE);
+  std::vector<std::unique_ptr<Chunk>> chunks;
+
+  for (std::size_t start = 0; start < data.size();)
+  {
+    std::size_t end = start + chunkSize < data.size() ? data.find('\n', start + chunkSize) : std::string_view::npos;
+    end = end == std::string_view::npos ? data.size() : end + 1;
+
+    chunks.emplace_back(std::make_unique<Chunk>());
+    chunks.back()->data = data.substr(start, end - start);
+    chunks.back()->offset = start;
+    start = end;
+  }
+
+  std::mutex doneLock;
+  std::condition_variable chunkDone;
+  std::size_t count = 0;
+
+  output.flush();
+
+  WorkStealingPool pool(threadCount);
+
+  for (std::unique_ptr<Chunk>& chunk : chunks)
+  {
+    pool.submit([&, chunk = chunk.get()]
+    {
+      chunk->count = searchLines(chunk->data, pattern, prefix, chunk->output, options, chunk->offset);
+
+      std::lock_guard<std::mutex> lock(doneLock);
+      chunk->done = true;
+      chunkDone.notify_all();
+    });
+  }
+
+  for (std::unique_ptr<Chunk>& chunk : chunks)
+  {
+    {
+      std::unique_lock<std::mutex> lock(doneLock);
+      chunkDone.wait(lock, [&chunk] { return chunk->done; });
+    }
+
+    chunk->output.flush();
+    count += chunk->count;
+  }
+
+  return count;
+}
+
+/**********************************************************************
+ * searchFile
+ *
+ * Description: Searches a file by mapping it into memory, files that
+ *      can't be mapped are read as a stream instead
+ *
+ * Parameters:
+ *   path: the file to search
+ *   pattern: the compiled patterns to match each line against
+ *   prefix: printed before each matching line
+ *   output: where matching lines are collected
+ *   threadCount: how many threads a large mapped file can be split over
+ *   options: how matching lines are reported
+ *
+ * Returns: how many lines matched
+ *********************************************************************/
+std::size_t searchFile(const std::string& path, const CompiledPattern& pattern, std::string_view prefix, OutputBuffer& output, unsigned threadCount, const OutputOptions& options)
+{
+  MappedFile file(path);
+
+  if (file.is_mapped())
+    return searchLinesParallel(file.data(), pattern, prefix, output, threadCount, options);
+
+  std::ifstream stream(path, std::ios::binary);
+  return searchStream(stream, pattern, prefix, output, options);
+}
+
+// shared by every task of a single recursive search
+struct DirectorySearch
+{
+  DirectorySearch(const CompiledPattern& pattern, const OutputOptions& options, WorkStealingPool& pool)
+  : pattern(pattern), options(options), pool(pool)
+  {
+  }
+
+  const CompiledPattern& pattern;
+  const OutputOptions& options;
+  WorkStealingPool& pool;
+  std::mutex outputLock;
+  std::atomic<bool> found = false;
+};
+
+/**********************************************************************
+ * queueFile
+ *
+ * Description: Queues a file to be searched, its output is collected
+ *      then written in one go so files never interleave
+ *
+ * Parameters:
+ *   search: the recursive search the file belongs to
+ *   path: the file to search
+ *********************************************************************/
+static void queueFile(DirectorySearch& search, std::string path)
+{
+  search.pool.submit([&search, path = std::move(path)]
+  {
+    OutputBuffer output(false);
+    std::string error;
+    std::size_t count = 0;
+
+    try
+    {
+      count = searchFile(path, search.pattern, path + ":", output, 1, search.options);
+
+      if (search.options.countOnly)
+        output.append(path + ":", std::to_string(count));
+    }
+    catch (const std::runtime_error& e)
+    {
+      error = e.what();
+    }
+
+    std::lock_guard<std::mutex> lock(search.outputLock);
+    output.flush();
+
+    if (!error.empty())
+      std::cerr << error << std::endl;
+
+    if (count > 0)
+      search.found = true;
+  });
+}
+
+/**********************************************************************
+ * queueDirectory
+ *
+ * Description: Queues a directory to be listed, every file in it is
+ *      queued to be searched and every directory to be listed in turn.
+ *      Symbolic links are skipped
+ *
+ * Parameters:
+ *   search: the recursive search the directory belongs to
+ *   path: the directory to list
+ *********************************************************************/
+static void queueDirectory(DirectorySearch& search, std::filesystem::path path)
+{
+  search.pool.submit([&search, path = std::move(path)]
+  {
+    std::error_code error;
+
+    for (std::filesystem::directory_iterator it(path, error), end; !error && it != end; it.increment(error))
+    {
+      std::error_code typeError;
+
+      if (it->is_symlink(typeError))
+        continue;
+
+      if (it->is_directory(typeError))
+        queueDirectory(search, it->path());
+      else if (it->is_regular_file(typeError))
+        queueFile(search, it->path().string());
+    }
+
+    if (error)
+    {
+      std::lock_guard<std::mutex> lock(search.outputLock);
+      std::cerr << path.string() << ": " << error.message() << std::endl;
+    }
+  });
+}
+
+/**********************************************************************
+ * searchDirectory
+ *
+ * Description: Searches every file under the directory on a pool of
+ *      worker threads that steal from each other when they run out of
+ *      work. Each file's lines are printed together, prefixed with its
+ *      path
+ *
+ * Parameters:
+ *   path: the directory (or single file) to search
+ *   pattern: the compiled patterns shared by every worker
+ *   threadCount: how many worker threads to use
+ *   options: how matching lines are reported
+ *
+ * Returns: true if any line matched
+ *********************************************************************/
+bool searchDirectory(const std::string& path, const CompiledPattern& pattern, unsigned threadCount, const OutputOptions& options)
+{
+  WorkStealingPool pool(threadCount);
+  DirectorySearch search(pattern, options, pool);
+
+  std::error_code error;
+  if (std::filesystem::is_directory(path, error))
+    queueDirectory(search, path);
+  else
+    queueFile(search, path);
+
+  pool.wait();
+
+  return search.found;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Patterns.hpp"
+
+#include <istream>
+#include <string>
+#include <string_view>
+
+// collects output so it is written to stdout in large blocks
+class OutputBuffer
+{
+  public:
+    OutputBuffer(bool flushWhenFull = true) : m_flushWhenFull(flushWhenFull) {};
+    ~OutputBuffer() { flush(); };
+
+    void append(std::string_view prefix, std::string_view line);
+    void append(OutputBuffer& other);
+    void appendPart(std::string_view part);
+    void flush();
+
+  private:
+    std::string m_buffer;
+    bool m_flushWhenFull;
+};
+
+// how matching lines are reported, set from the command line
+struct OutputOptions
+{
+  bool onlyMatching = false; // -o, each match on its own line instead of the whole line
+  bool byteOffset = false;   // -b, the offset in the input of each line or match before it
+  bool countOnly = false;    // --count, nothing but how many lines matched
+};
+
+std::size_t searchLines(std::string_view data, const CompiledPattern& pattern, std::string_view prefix, OutputBuffer& output, const OutputOptions& options = {}, std::size_t offset = 0);
+std::size_t searchStream(std::istream& stream, const CompiledPattern& pattern, std::string_view prefix, OutputBuffer& output, const OutputOptions& options = {});
+std::size_t searchStreamPipelined(std::istream& stream, const CompiledPattern& pattern, std::string_view prefix, OutputBuffer& output, unsigned threadCount,
+                                  const OutputOptions& options = {});
+std::size_t searchLinesParallel(std::string_view data, const CompiledPattern& pattern, std::string_view prefix, OutputBuffer& output, unsigned threadCount, const OutputOptions& options = {});
+std::size_t searchFile(const std::string& path, const CompiledPattern& pattern, std::string_view prefix, OutputBuffer& output, unsigned threadCount = 1, const OutputOptions& options = {});
+bool searchDirectory(const std::string& path, const CompiledPattern& pattern, unsigned threadCount, const OutputOptions& options = {});
@@ -1,47 +1,225 @@
+#include "PatternCache.hpp"
 #include "Patterns.hpp"
+#include "Search.hpp"
+#include "Stats.hpp"
 
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <vector>
+
+#if GREP_STATS
+#include <chrono>
+#endif
+
+/**********************************************************************
+ * readPatternFile
+ *
+ * Description: Reads a pattern set with one pattern per line, a
+ *      pattern's ID is its line number
+ *
+ * Parameters:
+ *   path: the file holding the patterns
+ *
+ * Returns: the patterns in file order
+ *********************************************************************/
+static std::vector<std::string> readPatternFile(const std::string& path)
+{
+  std::ifstream file(path);
+
+  if (!file)
+    throw std::runtime_error("Unable to open pattern file " + path);
+
+  std::vector<std::string> patterns;
+  std::string line;
+
+  while (std::getline(file, line))
+    patterns.push_back(line);
+
+  return patterns;
+}
+
+#if GREP_STATS
+/**********************************************************************
+ * writeStats
+ *
+ * Description: Writes the --stats report to stderr so it never mixes
+ *      with the matches
+ *
+ * Parameters:
+ *   pattern: the compiled patterns that were searched with
+ *   compile: the time taken to compile or load the patterns
+ *   search: the time taken to search and write the output
+ *********************************************************************/
+static void writeStats(const CompiledPattern& pattern, std::chrono::steady_clock::duration compile, std::chrono::steady_clock::duration search)
+{
+  JsonWriter json(std::cerr);
+
+  json.beginObject();
+  json.beginObject("stages");
+  json.field("compile_ms", std::chrono::duration<double, std::milli>(compile).count());
+  json.field("search_ms", std::chrono::duration<double, std::milli>(search).count());
+  json.endObject();
+  pattern.writeStats(json);
+  json.endObject();
+}
+#endif
 
 int main(int argc, char* argv[])
 {
-  // Flush after every std::cout / std::cerr
-  std::cout << std::unitbuf;
+  // Flush after every std::cerr
   std::cerr << std::unitbuf;
+  std::ios::sync_with_stdio(false);
 
-  // You can use print statements as follows for debugging, they'll be visible when running tests.
-  std::cout << "Logs from your program will appear here" << std::endl;
+  std::string patterns;
+  std::string patternFile;
+  std::string cacheDirectory;
+  std::vector<std::string> paths;
+  OutputOptions options;
+  bool havePatterns = false;
+  bool recursive = false;
 
-  if (argc != 3)
+#if GREP_STATS
+  bool stats = false;
+#endif
+
+  for (int i = 1; i < argc; ++i)
   {
-    std::cerr << "Expected two arguments" << std::endl;
-    return 1;
-  }
+    std::string argument = argv[i];
 
-  std::string flag = argv[1];
-  std::string pattern = argv[2];
+    if (!havePatterns && argument == "-E" && i + 1 < argc)
+    {
+      patterns = argv[++i];
+      havePatterns = true;
+    }
+    else if (!havePatterns && argument == "-f" && i + 1 < argc)
+    {
+      patternFile = argv[++i];
+      havePatterns = true;
+    }
+    else if (argument == "-r")
+    {
+      recursive = true;
+    }
+    else if (argument == "--cache-dir" && i + 1 < argc)
+    {
+      cacheDirectory = argv[++i];
+    }
+    else if (argument == "-o")
+    {
+      options.onlyMatching = true;
+    }
+    else if (argument == "-b")
+    {
+      options.byteOffset = true;
+    }
+    else if (argument == "--count")
+    {
+      options.countOnly = true;
+    }
+    else if (argument == "--stats")
+    {
+#if GREP_STATS
+      stats = true;
+#else
+      std::cerr << "--stats needs a build configured with -DGREP_STATS=ON" << std::endl;
+      return 1;
+#endif
+    }
+    else if (havePatterns)
+    {
+      paths.push_back(argument);
+    }
+    else
+    {
+      std::cerr << "Expected first argument to be '-E' or '-f'" << std::endl;
+      return 1;
+    }
+  }
 
-  if (flag != "-E")
+  if (!havePatterns)
   {
-    std::cerr << "Expected first argument to be '-E'" << std::endl;
+    std::cerr << "Expected '-E' followed by a pattern or '-f' followed by a pattern file" << std::endl;
     return 1;
   }
 
-  std::string input_line;
-  std::getline(std::cin, input_line);
+  // recursive searches default to the current directory like grep
+  if (recursive && paths.empty())
+    paths.push_back(".");
 
   try
   {
-    if (PatternHandler(input_line, pattern))
+#if GREP_STATS
+    auto compileStart = std::chrono::steady_clock::now();
+#endif
+
+    // compile the patterns once and reuse them for every line, a pattern
+    // file is compiled as one set so every line is only read once
+    std::vector<std::string> patternSet = patternFile.empty() ? std::vector<std::string>{patterns} : readPatternFile(patternFile);
+    std::unique_ptr<CompiledPattern> compiled;
+
+    // cached patterns only keep the automata which can't say where a match starts
+    if (!cacheDirectory.empty() && !options.onlyMatching)
+      compiled = compileCached(cacheDirectory, patternSet, !patternFile.empty());
+    else if (patternFile.empty())
+      compiled = std::make_unique<CompiledPattern>(patterns);
+    else
+      compiled = std::make_unique<CompiledPattern>(patternSet);
+    const CompiledPattern& pattern = *compiled;
+    OutputBuffer output;
+    bool found = false;
+
+#if GREP_STATS
+    auto searchStart = std::chrono::steady_clock::now();
+#endif
+
+    if (recursive)
     {
-      std::cout << "found\n";
-      return 0;
+      for (const std::string& path : paths)
+        found |= searchDirectory(path, pattern, std::thread::hardware_concurrency(), options);
     }
-    else
+    else if (paths.empty())
     {
-      std::cout << "not found\n";
-      return 1;
+      std::size_t count = searchStreamPipelined(std::cin, pattern, "", output, std::thread::hardware_concurrency(), options);
+      found = count > 0;
+
+      if (options.countOnly)
+        output.append("", std::to_string(count));
+    }
+
+    // lines are prefixed with their file name when there is more than one file
+    for (std::size_t i = 0; !recursive && i < paths.size(); ++i)
+    {
+      try
+      {
+        std::string prefix = paths.size() > 1 ? paths[i] + ":" : "";
+        std::size_t count = searchFile(paths[i], pattern, prefix, output, std::thread::hardware_concurrency(), options);
+        found |= count > 0;
+
+        if (options.countOnly)
+          output.append(prefix, std::to_string(count));
+      }
+      catch (const std::runtime_error& e)
+      {
+        output.flush();
+        std::cerr << e.what() << std::endl;
+      }
     }
+
+    output.flush();
+
+#if GREP_STATS
+    if (stats)
+      writeStats(pattern, searchStart - compileStart, std::chrono::steady_clock::now() - searchStart);
+#endif
+
+    if (found)
+      return 0;
+    else
+      return 1;
   }
   catch (const std::runtime_error& e)
   {
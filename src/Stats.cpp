@@ -0,0 +1,162 @@
+#include "Stats.hpp"
+
+#if GREP_STATS
+
+#include <cstdio>
+
+/**********************************************************************
+ * beginObject / endObject / beginArray / endArray
+ *
+ * Description: Open and close a JSON object or array, one opened as a
+ *      field has a name, one in an array or at the top level doesn't
+ *
+ * Parameters:
+ *   name: the field the object or array is the value of
+ *********************************************************************/
+void JsonWriter::beginObject(std::string_view name)
+{
+  key(name);
+  m_output << '{';
+  m_indent += "  ";
+  m_first = true;
+}
+
+void JsonWriter::endObject()
+{
+  m_indent.resize(m_indent.size() - 2);
+  m_output << '\n' << m_indent << '}';
+  m_first = false;
+
+  if (m_indent.empty())
+    m_output << '\n';
+}
+
+void JsonWriter::beginArray(std::string_view name)
+{
+  key(name);
+  m_output << '[';
+  m_indent += "  ";
+  m_first = true;
+}
+
+void JsonWriter::endArray()
+{
+  m_indent.resize(m_indent.size() - 2);
+  m_output << '\n' << m_indent << ']';
+  m_first = false;
+}
+
+/**********************************************************************
+ * field
+ *
+ * Description: Writes a named value in the current object, strings are
+ *      escaped since instruction names can hold any byte
+ *
+ * Parameters:
+ *   name: the field name
+ *   value: its value
+ *********************************************************************/
+void JsonWriter::field(std::string_view name, std::uint64_t value)
+{
+  key(name);
+  m_output << value;
+}
+
+void JsonWriter::field(std::string_view name, double value)
+{
+  key(name);
+  m_output << value;
+}
+
+void JsonWriter::field(std::string_view name, std::string_view value)
+{
+  key(name);
+  m_output << '"';
+
+  for (char c : value)
+  {
+    if (c == '"' || c == '\\')
+    {
+      m_output << '\\' << c;
+    }
+    else if (static_cast<unsigned char>(c) < 0x20 || static_cast<unsigned char>(c) >= 0x7f)
+    {
+      char escaped[8];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned char>(c));
+      m_output << escaped;
+    }
+    else
+    {
+      m_output << c;
+    }
+  }
+
+  m_output << '"';
+}
+
+/**********************************************************************
+ * filter
+ *
+ * Description: Writes a prefilter's counts along with the fraction of
+ *      inputs it let through, the lower the more work it saved. One
+ *      that was never asked is left out
+ *
+ * Parameters:
+ *   name: the prefilter
+ *   filter: its counts
+ *********************************************************************/
+void JsonWriter::filter(std::string_view name, const FilterStats& filter)
+{
+  std::uint64_t checked = filter.checked.value();
+  if (checked == 0)
+    return;
+
+  beginObject(name);
+  field("checked", checked);
+  field("passed", filter.passed.value());
+  field("hit_rate", static_cast<double>(filter.passed.value()) / checked);
+  endObject();
+}
+
+/**********************************************************************
+ * engine
+ *
+ * Description: Writes an engine's counts, times are in milliseconds
+ *
+ * Parameters:
+ *   name: the engine
+ *   engine: its counts
+ *********************************************************************/
+void JsonWriter::engine(std::string_view name, const EngineStats& engine)
+{
+  beginObject(name);
+  field("calls", engine.calls.value());
+  field("bytes", engine.bytes.value());
+  field("ms", engine.nanoseconds.value() / 1e6);
+  endObject();
+}
+
+/**********************************************************************
+ * key
+ *
+ * Description: Starts the next value on its own line, after a comma if
+ *      it isn't the first in its object or array
+ *
+ * Parameters:
+ *   name: the field name, empty for an array element or the top level
+ *********************************************************************/
+void JsonWriter::key(std::string_view name)
+{
+  if (!m_first)
+    m_output << ',';
+
+  if (!m_indent.empty())
+    m_output << '\n' << m_indent;
+
+  if (!name.empty())
+    m_output << '"' << name << "\": ";
+
+  m_first = false;
+}
+
+#endif
@@ -0,0 +1,100 @@
+#pragma once
+
+// counters behind --stats, they only exist in a build configured with
+// GREP_STATS so an ordinary build carries no trace of them
+#if GREP_STATS
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+// a count shared by every searching thread, relaxed since it is only read
+// once the search is over
+class StatsCounter
+{
+  public:
+    void add(std::uint64_t amount = 1) { m_value.fetch_add(amount, std::memory_order_relaxed); };
+    std::uint64_t value() const { return m_value.load(std::memory_order_relaxed); };
+
+  private:
+    std::atomic<std::uint64_t> m_value = 0;
+};
+
+// a prefilter, the inputs it was asked about and how many it let through
+struct FilterStats
+{
+  StatsCounter checked;
+  StatsCounter passed;
+
+  bool record(bool pass)
+  {
+    checked.add();
+    if (pass)
+      passed.add();
+
+    return pass;
+  }
+};
+
+// a matching engine, how often it ran, the bytes it read and how long it took
+struct EngineStats
+{
+  StatsCounter calls;
+  StatsCounter bytes;
+  StatsCounter nanoseconds;
+};
+
+// one instruction of the backtracker, how often it was reached and how
+// often what it chose failed so it had to try something else
+struct InstructionStats
+{
+  StatsCounter steps;
+  StatsCounter backtracks;
+};
+
+// adds the time until it goes out of scope to an engine's total
+class StatsTimer
+{
+  public:
+    StatsTimer(EngineStats& engine) : m_engine(engine), m_start(std::chrono::steady_clock::now()) { m_engine.calls.add(); };
+    ~StatsTimer() { m_engine.nanoseconds.add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count()); };
+
+    StatsTimer(const StatsTimer&) = delete;
+    StatsTimer& operator=(const StatsTimer&) = delete;
+
+  private:
+    EngineStats& m_engine;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+// writes the report as JSON, keeping track of where commas go
+class JsonWriter
+{
+  public:
+    JsonWriter(std::ostream& output) : m_output(output) {};
+    ~JsonWriter() = default;
+
+    void beginObject(std::string_view name = {});
+    void endObject();
+    void beginArray(std::string_view name);
+    void endArray();
+
+    void field(std::string_view name, std::uint64_t value);
+    void field(std::string_view name, double value);
+    void field(std::string_view name, std::string_view value);
+
+    void filter(std::string_view name, const FilterStats& filter);
+    void engine(std::string_view name, const EngineStats& engine);
+
+  private:
+    void key(std::string_view name);
+
+    std::ostream& m_output;
+    std::string m_indent;
+    bool m_first = true;
+};
+
+#endif
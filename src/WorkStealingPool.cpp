@@ -0,0 +1,158 @@
+#include "WorkStealingPool.hpp"
+
+#include <algorithm>
+
+// lets a task submit more work straight onto its own worker's deque
+static thread_local WorkStealingPool* t_pool = nullptr;
+static thread_local unsigned t_workerIndex = 0;
+
+/**********************************************************************
+ * WorkStealingPool
+ *
+ * Description: Starts the worker threads, they sleep until work is
+ *      submitted
+ *
+ * Parameters:
+ *   threadCount: how many workers to start (at least one)
+ *********************************************************************/
+WorkStealingPool::WorkStealingPool(unsigned threadCount)
+{
+  threadCount = std::max(threadCount, 1u);
+
+  for (unsigned i = 0; i < threadCount; ++i)
+    m_workers.emplace_back(std::make_unique<Worker>());
+
+  for (unsigned i = 0; i < threadCount; ++i)
+    m_threads.emplace_back(&WorkStealingPool::run, this, i);
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+  wait();
+
+  {
+    std::lock_guard<std::mutex> lock(m_stateLock);
+    m_stopping = true;
+  }
+  m_taskAdded.notify_all();
+
+  for (std::thread& thread : m_threads)
+    thread.join();
+}
+
+/**********************************************************************
+ * submit
+ *
+ * Description: Queues a task, tasks submitted by a worker go on its own
+ *      deque so related work stays on one thread unless it is stolen
+ *
+ * Parameters:
+ *   task: the work to run on one of the workers
+ *********************************************************************/
+void WorkStealingPool::submit(std::function<void()> task)
+{
+  unsigned index = t_pool == this ? t_workerIndex : m_nextWorker++ % m_workers.size();
+
+  // counted before it is visible so a worker taking it never sees the count below zero
+  {
+    std::lock_guard<std::mutex> lock(m_stateLock);
+    ++m_pending;
+    ++m_queued;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_workers[index]->lock);
+    m_workers[index]->tasks.push_back(std::move(task));
+  }
+  m_taskAdded.notify_one();
+}
+
+/**********************************************************************
+ * wait
+ *
+ * Description: Blocks until every submitted task (and every task they
+ *      submitted) has finished
+ *********************************************************************/
+void WorkStealingPool::wait()
+{
+  std::unique_lock<std::mutex> lock(m_stateLock);
+  m_allDone.wait(lock, [this] { return m_pending == 0; });
+}
+
+/**********************************************************************
+ * takeTask
+ *
+ * Description: Takes the newest task from the worker's own deque, or
+ *      steals the oldest task from another worker
+ *
+ * Parameters:
+ *   index: the worker looking for work
+ *   task: set to the task that was taken
+ *
+ * Returns: true if a task was taken
+ *********************************************************************/
+bool WorkStealingPool::takeTask(unsigned index, std::function<void()>& task)
+{
+  for (std::size_t i = 0; i < m_workers.size(); ++i)
+  {
+    Worker& worker = *m_workers[(index + i) % m_workers.size()];
+    std::lock_guard<std::mutex> lock(worker.lock);
+
+    if (worker.tasks.empty())
+      continue;
+
+    if (i == 0)
+    {
+      task = std::move(worker.tasks.back());
+      worker.tasks.pop_back();
+    }
+    else
+    {
+      task = std::move(worker.tasks.front());
+      worker.tasks.pop_front();
+    }
+
+    --m_queued;
+    return true;
+  }
+
+  return false;
+}
+
+/**********************************************************************
+ * run
+ *
+ * Description: Worker loop, runs tasks until the pool is destroyed and
+ *      sleeps whenever there is nothing queued anywhere
+ *
+ * Parameters:
+ *   index: this worker's index
+ *********************************************************************/
+void WorkStealingPool::run(unsigned index)
+{
+  t_pool = this;
+  t_workerIndex = index;
+
+  std::function<void()> task;
+
+  while (true)
+  {
+    if (takeTask(index, task))
+    {
+      task();
+      task = nullptr;
+
+      std::lock_guard<std::mutex> lock(m_stateLock);
+      if (--m_pending == 0)
+        m_allDone.notify_all();
+
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(m_stateLock);
+    m_taskAdded.wait(lock, [this] { return m_queued > 0 || m_stopping; });
+
+    if (m_stopping && m_queued == 0)
+      return;
+  }
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkStealingPool
+{
+  public:
+    WorkStealingPool(unsigned threadCount);
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    void submit(std::function<void()> task);
+    void wait();
+
+  private:
+    // each worker has its own deque, it works from the back and others steal from the front
+    struct Worker
+    {
+      std::mutex lock;
+      std::deque<std::function<void()>> tasks;
+    };
+
+    void run(unsigned index);
+    bool takeTask(unsigned index, std::function<void()>& task);
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::vector<std::thread> m_threads;
+    std::atomic<unsigned> m_nextWorker = 0;
+
+    std::mutex m_stateLock;
+    std::condition_variable m_taskAdded, m_allDone;
+    std::atomic<std::size_t> m_queued = 0;
+    std::size_t m_pending = 0;
+    bool m_stopping = false;
+};
@@ -0,0 +1,156 @@
+#include "Patterns.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// the corpus is generated from a fixed seed so every run checks the same lines
+constexpr std::uint64_t CORPUS_SEED = 0x6772657063707000;
+constexpr std::size_t LINE_COUNT = 5000;
+constexpr unsigned THREAD_COUNT = 8;
+constexpr int ROUNDS = 2;
+
+/**********************************************************************
+ * generateLines
+ *
+ * Description: Builds log like lines of words, numbers and the odd
+ *      repeated word so every pattern has something to find
+ *
+ * Returns: the lines
+ *********************************************************************/
+static std::vector<std::string> generateLines()
+{
+  static const std::vector<std::string> words = {
+    "ERROR", "WARN", "INFO", "DEBUG", "request", "user", "timeout", "connection", "reset", "id",
+    "host", "db01.example.com", "latency", "ms", "retry", "cache", "miss", "hit", "the", "a_b"
+  };
+
+  std::mt19937_64 random(CORPUS_SEED);
+  std::uniform_int_distribution<std::size_t> length(1, 16);
+  std::uniform_int_distribution<std::size_t> word(0, words.size() - 1);
+  std::uniform_int_distribution<int> kind(0, 9);
+  std::vector<std::string> lines;
+
+  for (std::size_t i = 0; i < LINE_COUNT; ++i)
+  {
+    std::string line, previous;
+
+    for (std::size_t count = length(random); count > 0; --count)
+    {
+      // mostly words, some numbers and now and then the previous word again
+      int k = kind(random);
+      if (k == 0)
+        previous = std::to_string(random() % 10000);
+      else if (k != 1 || previous.empty())
+        previous = words[word(random)];
+
+      line += (line.empty() ? "" : " ") + previous;
+    }
+
+    lines.push_back(line);
+  }
+
+  return lines;
+}
+
+/**********************************************************************
+ * main
+ *
+ * Description: Compiles and matches on many threads at once. Every
+ *      thread compiles its own copy of each pattern while matching with
+ *      copies shared by all of them, any result that differs from the
+ *      single threaded answer fails the test
+ *
+ * Returns: 0 if every result matched, 1 otherwise
+ *********************************************************************/
+int main()
+{
+  // one pattern per engine: NFA and lazy DFA, keywords, prefilter, reverse suffix and backtracker
+  const std::vector<std::string> patterns = {
+    "(ERROR|WARN) user", "ERROR|WARN|timeout", "\\w+ \\d+ ms$", "(\\w+) \\1", "[A-Z]+ [a-z]+ (\\d+)", ".*\\d+ timeout"
+  };
+  const std::vector<std::string> patternSet = {"ERROR \\w+ \\d+", "timeout", "(\\w+) \\1 ms", "^INFO", "db01.example.com latency"};
+
+  std::vector<std::string> lines = generateLines();
+  std::vector<std::unique_ptr<CompiledPattern>> shared;
+  std::vector<std::vector<std::size_t>> expected; // match() of every line for each pattern
+
+  for (const std::string& pattern : patterns)
+  {
+    shared.push_back(std::make_unique<CompiledPattern>(pattern));
+    expected.emplace_back();
+
+    for (const std::string& line : lines)
+      expected.back().push_back(shared.back()->match(line));
+  }
+
+  CompiledPattern sharedSet(patternSet);
+  std::vector<std::vector<std::size_t>> expectedSet(lines.size());
+
+  for (std::size_t i = 0; i < lines.size(); ++i)
+    sharedSet.matchingPatterns(lines[i], expectedSet[i]);
+
+  std::atomic<std::size_t> failures = 0;
+  std::vector<std::thread> threads;
+
+  for (unsigned thread = 0; thread < THREAD_COUNT; ++thread)
+  {
+    threads.emplace_back([&, thread]()
+    {
+      std::vector<std::size_t> matched;
+
+      for (int round = 0; round < ROUNDS; ++round)
+      {
+        // each thread starts on a different pattern so they compile and match different ones at once
+        for (std::size_t n = 0; n < patterns.size(); ++n)
+        {
+          std::size_t k = (n + thread) % patterns.size();
+          CompiledPattern own(patterns[k]);
+          const CompiledPattern& pattern = *shared[k];
+
+          for (std::size_t i = 0; i < lines.size(); ++i)
+          {
+            bool expectedMatch = expected[k][i] != std::string::npos;
+
+            if (pattern.match(lines[i]) != expected[k][i] || pattern.matches(lines[i]) != expectedMatch ||
+                own.matches(lines[i]) != expectedMatch)
+            {
+              if (failures++ == 0)
+                std::cerr << "pattern '" << patterns[k] << "' differs on line '" << lines[i] << "'" << std::endl;
+            }
+          }
+        }
+
+        CompiledPattern ownSet(patternSet);
+
+        for (std::size_t i = 0; i < lines.size(); ++i)
+        {
+          for (const CompiledPattern* set : {&sharedSet, &ownSet})
+          {
+            set->matchingPatterns(lines[i], matched);
+
+            if (matched != expectedSet[i] && failures++ == 0)
+              std::cerr << "pattern set differs on line '" << lines[i] << "'" << std::endl;
+          }
+        }
+      }
+    });
+  }
+
+  for (std::thread& thread : threads)
+    thread.join();
+
+  if (failures > 0)
+  {
+    std::cerr << failures << " concurrent results differed from the single threaded ones" << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
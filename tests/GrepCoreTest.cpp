@@ -0,0 +1,335 @@
+#include "GrepCore.hpp"
+#include "PatternCache.hpp"
+#include "Patterns.hpp"
+#include "Search.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+static int s_failures = 0;
+
+/**********************************************************************
+ * check
+ *
+ * Description: Reports a check that didn't hold, the test carries on
+ *      so every failure is listed
+ *
+ * Parameters:
+ *   passed: whether the check held
+ *   what: what was being checked
+ *********************************************************************/
+static void check(bool passed, const std::string& what)
+{
+  if (!passed)
+  {
+    std::cerr << "failed: " << what << std::endl;
+    ++s_failures;
+  }
+}
+
+/**********************************************************************
+ * checkFind
+ *
+ * Description: The public API on a few patterns, including the empty
+ *      pattern which matches the empty string everywhere
+ *********************************************************************/
+static void checkFind()
+{
+  GrepPattern digits("\\d+");
+  std::optional<GrepMatch> match = digits.find("id 42 ok");
+  check(match && match->start == 3 && match->end == 5 && match->text() == "42", "find '\\d+' in 'id 42 ok'");
+  check(!digits.find("id 42 ok", 5), "find '\\d+' after the only number");
+
+  GrepPattern group("(\\w+) \\1");
+  match = group.find("a hit hit");
+  check(match && match->groups.size() == 2 && match->groups[1] == "hit", "find '(\\w+) \\1' captures the word");
+
+  GrepPattern empty("");
+  check(empty.matches("abc") && empty.matches(""), "'' matches everything");
+
+  match = empty.find("abc", 2);
+  check(match && match->start == 2 && match->end == 2, "find '' gives an empty match at from");
+  check(empty.find("", 0).has_value(), "find '' in an empty input");
+  check(!empty.find("abc", 4), "find '' past the end of the input");
+
+  std::vector<GrepMatch> matches = empty.findAll("abc");
+  check(matches.size() == 4, "findAll '' gives an empty match at every position");
+
+  for (std::size_t i = 0; i < matches.size(); ++i)
+    check(matches[i].start == i && matches[i].end == i, "findAll '' match " + std::to_string(i));
+}
+
+/**********************************************************************
+ * checkNestedQuantifier
+ *
+ * Description: A nested quantifier that fails to match and then
+ *      matches later on the line, backtracking into it would take
+ *      2^30 steps so find must take the span from the automata
+ *********************************************************************/
+static void checkNestedQuantifier()
+{
+  GrepPattern nested("(a+)+b");
+  const std::string input = std::string(30, 'a') + "c ab";
+  std::optional<GrepMatch> match = nested.find(input);
+  check(match && match->start == 32 && match->end == 34, "find '(a+)+b' after a run of a's");
+  check(match && match->groups.size() == 2 && match->groups[1] == "a", "find '(a+)+b' captures the last a");
+  check(nested.findAll(input).size() == 1, "findAll '(a+)+b' after a run of a's");
+
+  // skipping to the next 'b' mustn't lose the '$' at the end
+  match = GrepPattern("b?$").find("abc");
+  check(match && match->start == 3 && match->end == 3, "find 'b?$' at the end of 'abc'");
+}
+
+/**********************************************************************
+ * checkLongBacktrack
+ *
+ * Description: A backreference needs the backtracker, going round a
+ *      group for every byte of a long line must not run it out of stack
+ *********************************************************************/
+static void checkLongBacktrack()
+{
+  std::string input;
+  for (int i = 0; i < 1 << 18; ++i)
+    input += "ab";
+  input += "xa";
+
+  GrepPattern pairs("((a)|b)+x\\2");
+  std::optional<GrepMatch> match = pairs.find(input);
+  check(match && match->start == 0 && match->end == input.size(), "find '((a)|b)+x\\2' after 2^18 pairs");
+}
+
+/**********************************************************************
+ * checkOnlyMatching
+ *
+ * Description: -o with the empty pattern counts the line as matching
+ *      but like grep writes nothing for the empty matches
+ *********************************************************************/
+static void checkOnlyMatching()
+{
+  CompiledPattern empty(std::string(""));
+  OutputOptions options;
+  options.onlyMatching = true;
+
+  try
+  {
+    OutputBuffer output(false);
+    check(searchLines("abc\n\n", empty, "", output, options) == 2, "-o '' matches every line");
+
+    options.byteOffset = true;
+    check(searchLines("abc\n", empty, "", output, options) == 1, "-o -b '' matches the line");
+  }
+  catch (const std::runtime_error& e)
+  {
+    check(false, std::string("-o '' threw ") + e.what());
+  }
+}
+
+/**********************************************************************
+ * checkOnlyMatchingSpans
+ *
+ * Description: -o takes its spans from the NFA, a nested quantifier
+ *      that fails along a run of a's and a line far longer than a read
+ *      that is one long match must both come out whole
+ *********************************************************************/
+static void checkOnlyMatchingSpans()
+{
+  OutputOptions options;
+  options.onlyMatching = true;
+
+  // what the output buffers flush to stdout is collected here instead
+  std::ostringstream written;
+  std::streambuf* console = std::cout.rdbuf(written.rdbuf());
+
+  {
+    CompiledPattern nested(std::string("(a+)+b"));
+    OutputBuffer output(false);
+    searchLines(std::string(30, 'a') + "c ab\n", nested, "", output, options);
+  }
+
+  bool nestedWhole = written.str() == "ab\n";
+  written.str("");
+
+  std::string pairs;
+  for (int i = 0; i < 2000000; ++i)
+    pairs += "ab";
+
+  {
+    CompiledPattern repeated(std::string("(ab)+"));
+    std::istringstream stream(pairs + "\n");
+    OutputBuffer output(false);
+    searchStream(stream, repeated, "", output, options);
+  }
+
+  bool pairsWhole = written.str() == pairs + "\n";
+  std::cout.rdbuf(console);
+
+  check(nestedWhole, "-o '(a+)+b' after a run of a's");
+  check(pairsWhole, "-o '(ab)+' on a 4MB line");
+}
+
+/**********************************************************************
+ * checkLongLines
+ *
+ * Description: Lines longer than a read are matched a piece at a time,
+ *      a match split between pieces or needing the end of the line must
+ *      still be found, serially and in the pipeline
+ *********************************************************************/
+static void checkLongLines()
+{
+  const std::string filler(3 << 20, 'x');
+  const std::string input = "ERROR short\n" + filler + "ERROR" + filler + "\n" + filler + " 42\n" + filler + "ERROR\nlast 7";
+
+  OutputOptions options;
+  options.countOnly = true;
+
+  const std::vector<std::pair<std::string, std::size_t>> expected = {
+    {"ERROR", 3}, {"x \\d+$", 1}, {"\\d$", 2}, {"^x+ERROR$", 1}, {"y", 0}, {"", 5}
+  };
+
+  for (const auto& [text, count] : expected)
+  {
+    CompiledPattern pattern(text);
+
+    for (unsigned threads : {1u, 4u})
+    {
+      std::istringstream stream(input);
+      OutputBuffer output(false);
+      check(searchStreamPipelined(stream, pattern, "", output, threads, options) == count,
+            "'" + text + "' on long lines with " + std::to_string(threads) + " threads");
+    }
+  }
+}
+
+/**********************************************************************
+ * checkRepeatLimit
+ *
+ * Description: Nested counts multiply when the NFA copies them out, a
+ *      group that would unroll past the limit is refused when parsed
+ *      while one within it still matches
+ *********************************************************************/
+static void checkRepeatLimit()
+{
+  for (const std::string text : {"(a{1000}){1000}", "(a{100}){100}", "((a{10}){10}){11}", "(abc){334}"})
+  {
+    try
+    {
+      CompiledPattern pattern(text);
+      check(false, "'" + text + "' is refused");
+    }
+    catch (const std::runtime_error&)
+    {
+    }
+  }
+
+  CompiledPattern nested("(a{10}){100}");
+  check(nested.matches(std::string(1000, 'a')) && !nested.matches(std::string(999, 'a')), "'(a{10}){100}' needs 1000 a's");
+
+  CompiledPattern optional("(x{600}|a{600})?b");
+  check(optional.matches("b"), "an optional group isn't copied so it is allowed");
+}
+
+/**********************************************************************
+ * checkDamagedCache
+ *
+ * Description: A cache file with an impossible state count or cut
+ *      short is treated like a missing one, the pattern is compiled
+ *      again rather than the load failing
+ *********************************************************************/
+static void checkDamagedCache()
+{
+  std::filesystem::path directory = std::filesystem::temp_directory_path() / ("grepcore_test_cache_" + std::to_string(::getpid()));
+  std::filesystem::remove_all(directory);
+
+  const std::string text = "ab+c";
+  compileCached(directory.string(), {text}, false);
+
+  std::filesystem::path file;
+  for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(directory))
+    file = entry.path();
+
+  // a pattern loaded from the cache can't report positions, so find only works on a miss
+  auto compiledAgain = [&]()
+  {
+    try
+    {
+      std::unique_ptr<CompiledPattern> pattern = compileCached(directory.string(), {text}, false);
+      std::size_t start;
+      MatchState state(pattern->groupCount());
+      return pattern->matches("xabbc") && pattern->find("xabbc", 0, start, state) == 5 && start == 1;
+    }
+    catch (const std::exception&)
+    {
+      return false;
+    }
+  };
+
+  check(!compiledAgain(), "an intact cache is loaded");
+
+  {
+    // the NFA's state count follows the header, the pattern text and the pattern set flag
+    std::fstream stream(file, std::ios::in | std::ios::out | std::ios::binary);
+    stream.seekp(8 + 4 + 4 + 1 + 8 + 8 + text.size() + 1);
+    std::uint64_t count = std::uint64_t(1) << 62;
+    stream.write(reinterpret_cast<const char*>(&count), sizeof(count));
+  }
+  check(compiledAgain(), "a cache with an impossible state count is a miss");
+
+  std::filesystem::resize_file(file, std::filesystem::file_size(file) / 2);
+  check(compiledAgain(), "a truncated cache is a miss");
+
+  std::filesystem::remove_all(directory);
+}
+
+#if GREP_STATS
+/**********************************************************************
+ * checkFilterStats
+ *
+ * Description: A search jumping between lines with a filter's literals
+ *      still counts every line it jumped over as checked
+ *********************************************************************/
+static void checkFilterStats()
+{
+  std::string data;
+  for (int i = 0; i < 1000; ++i)
+    data += i == 500 ? "ERROR user 42 timeout\n" : "INFO ok 5 ms\n";
+  data += "INFO last";
+
+  CompiledPattern prefiltered("(\\w+) \\d+ timeout");
+  CompiledPattern keywords("ERROR|timeout");
+  OutputOptions options;
+  options.countOnly = true;
+  OutputBuffer output(false);
+
+  searchLines(data, prefiltered, "", output, options);
+  check(prefiltered.prefilterStats().checked.value() == 1001 && prefiltered.prefilterStats().passed.value() == 1, "prefilter counts every line");
+
+  searchLines(data, keywords, "", output, options);
+  check(keywords.keywordStats().checked.value() == 1001 && keywords.keywordStats().passed.value() == 1, "keywords count every line");
+}
+#endif
+
+int main()
+{
+  checkFind();
+  checkNestedQuantifier();
+  checkLongBacktrack();
+  checkOnlyMatching();
+  checkOnlyMatchingSpans();
+  checkLongLines();
+  checkRepeatLimit();
+  checkDamagedCache();
+
+#if GREP_STATS
+  checkFilterStats();
+#endif
+
+  return s_failures > 0 ? 1 : 0;
+}